@@ -0,0 +1,293 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*Exchange buffer benchmark: every buffer is driven by pinned producer and consumer threads in 1:1, N:1, 1:N and N:M layouts.
+ * Items carry send time, consumers record handoff latency, hardware cache misses are read from perf counters when kernel allows.
+ * Usage: ExchangeBufferBenchmark --items 1000000 --threads 4 --capacity 1024 [--base]*/
+#include <QtCore>
+#include <pthread.h>
+#include <sched.h>
+#ifdef Q_OS_LINUX
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <thread>
+#include <vector>
+
+#include "../IExchangeBuffer.h"
+#include "../metrics.h"
+
+struct BenchItem {
+    BenchItem(const qint64 send_ns_ = 0) : send_ns(send_ns_) {}
+
+    qint64 send_ns;
+};
+
+template<class Buffer>
+class SharedAdapter {
+public:
+    SharedAdapter(const quint64 capacity) : buffer(capacity) {}
+
+    bool push(const qint64 stamp) {
+        QSharedPointer<BenchItem> item(new BenchItem(stamp));
+        return buffer.add_item(item);
+    }
+    bool pop(qint64& stamp) {
+        QSharedPointer<BenchItem> item;
+        if(!buffer.try_to_read_item(item)) return false;
+        stamp = item->send_ns;
+        return true;
+    }
+private:
+    Buffer buffer;
+};
+
+/*BaseExchangeBuffer is unbounded and has no capacity argument*/
+class BaseAdapter {
+public:
+    BaseAdapter(const quint64) {
+        buffer.reset();
+    }
+
+    bool push(const qint64 stamp) {
+        QSharedPointer<BenchItem> item(new BenchItem(stamp));
+        return buffer.add_item(item);
+    }
+    bool pop(qint64& stamp) {
+        QSharedPointer<BenchItem> item;
+        if(!buffer.try_to_read_item(item)) return false;
+        stamp = item->send_ns;
+        return true;
+    }
+private:
+    BaseExchangeBuffer<BenchItem> buffer;
+};
+
+template<class Ring>
+class ValueAdapter {
+public:
+    ValueAdapter(const quint64 capacity) : buffer(capacity) {}
+
+    bool push(const qint64 stamp) {
+        BenchItem item(stamp);
+        return buffer.add_item(item);
+    }
+    bool pop(qint64& stamp) {
+        BenchItem item;
+        if(!buffer.try_to_read_item(item)) return false;
+        stamp = item.send_ns;
+        return true;
+    }
+private:
+    ValueExchangeBuffer<BenchItem, Ring> buffer;
+};
+
+template<class Ring>
+class PooledAdapter {
+public:
+    PooledAdapter(const quint64 capacity) : buffer(capacity) {}
+
+    bool push(const qint64 stamp) {
+        PooledNode<BenchItem>* node = buffer.acquire_node();
+        if(node == NULL) return false;
+        node->value.send_ns = stamp;
+        if(buffer.add_item(node)) return true;
+        node->release();
+        return false;
+    }
+    bool pop(qint64& stamp) {
+        PooledNode<BenchItem>* node = NULL;
+        if(!buffer.try_to_read_item(node)) return false;
+        stamp = node->value.send_ns;
+        node->release();
+        return true;
+    }
+private:
+    PooledExchangeBuffer<BenchItem, Ring> buffer;
+};
+
+/*Per thread hardware counter of cache misses, invalid when perf events are not permitted*/
+class CacheMissCounter {
+public:
+    CacheMissCounter() : descriptor(-1) {
+#ifdef Q_OS_LINUX
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        descriptor = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        if(descriptor >= 0) {
+            ioctl(descriptor, PERF_EVENT_IOC_RESET, 0);
+            ioctl(descriptor, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+    ~CacheMissCounter() {
+#ifdef Q_OS_LINUX
+        if(descriptor >= 0) close(descriptor);
+#endif
+    }
+    /*-1 when counter is not available*/
+    qint64 read() const {
+#ifdef Q_OS_LINUX
+        quint64 value = 0;
+        if(descriptor >= 0 && ::read(descriptor, &value, sizeof(value)) == sizeof(value)) return qint64(value);
+#endif
+        return -1;
+    }
+private:
+    int descriptor;
+};
+
+static void pin_thread(const int index) {
+#ifdef Q_OS_LINUX
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(index % QThread::idealThreadCount(), &cpu_set);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+#else
+    Q_UNUSED(index);
+#endif
+}
+
+struct CaseResult {
+    CaseResult() : ops_per_sec(0.0), cache_misses(0), misses_available(true) {}
+
+    double ops_per_sec;
+    HistogramSnapshot latency;
+    qint64 cache_misses;
+    bool misses_available;
+};
+
+/*Every producer pushes items_per_producer items, consumers share total between them*/
+template<class Adapter>
+static CaseResult run_case(const int producers, const int consumers, const quint64 items_per_producer, const quint64 capacity) {
+    Adapter adapter(capacity);
+    const quint64 total = items_per_producer * producers;
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::atomic<quint64> consumed(0);
+    std::vector<LatencyHistogram*> histograms;
+    std::vector<qint64> misses(producers + consumers, -1);
+    std::vector<std::thread> threads;
+    for(int i = 0; i < consumers; ++i) {
+        histograms.push_back(new LatencyHistogram());
+    }
+    for(int i = 0; i < producers; ++i) {
+        threads.push_back(std::thread([&, i]() {
+            pin_thread(i);
+            CacheMissCounter counter;
+            ++ready;
+            while(!go.load(std::memory_order_acquire)) {}
+            for(quint64 n = 0; n < items_per_producer;) {
+                if(adapter.push(metrics_now_ns()))
+                    ++n;
+                else
+                    std::this_thread::yield();
+            }
+            misses[i] = counter.read();
+        }));
+    }
+    for(int i = 0; i < consumers; ++i) {
+        threads.push_back(std::thread([&, i]() {
+            pin_thread(producers + i);
+            CacheMissCounter counter;
+            LatencyHistogram* histogram = histograms[i];
+            ++ready;
+            while(!go.load(std::memory_order_acquire)) {}
+            qint64 stamp = 0;
+            while(consumed.load(std::memory_order_relaxed) < total) {
+                if(!adapter.pop(stamp)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                histogram->record(metrics_now_ns() - stamp);
+                consumed.fetch_add(1, std::memory_order_relaxed);
+            }
+            misses[producers + i] = counter.read();
+        }));
+    }
+    while(ready.load() < producers + consumers) std::this_thread::yield();
+    qint64 start_ns = metrics_now_ns();
+    go.store(true, std::memory_order_release);
+    for(size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    CaseResult result;
+    result.ops_per_sec = total / ((metrics_now_ns() - start_ns) / 1e9);
+    for(size_t i = 0; i < histograms.size(); ++i) {
+        HistogramSnapshot snapshot;
+        histograms[i]->snapshot(snapshot);
+        result.latency.merge(snapshot);
+        delete histograms[i];
+    }
+    for(size_t i = 0; i < misses.size(); ++i) {
+        if(misses[i] < 0) result.misses_available = false;
+        result.cache_misses += qMax<qint64>(0, misses[i]);
+    }
+    return result;
+}
+
+template<class Adapter>
+static void report(const char* name, const int producers, const int consumers, const quint64 items, const quint64 capacity) {
+    quint64 items_per_producer = qMax<quint64>(1, items / producers);
+    CaseResult result = run_case<Adapter>(producers, consumers, items_per_producer, capacity);
+    QByteArray misses = result.misses_available ? QByteArray::number(double(result.cache_misses) / (items_per_producer * producers), 'f', 2) : QByteArray("n/a");
+    printf("%-26s %2d:%-2d %12.0f ops/s  p50 %8llu ns  p99 %8llu ns  p999 %9llu ns  misses/op %s\n", name, producers, consumers, result.ops_per_sec,
+           (unsigned long long)result.latency.value_at_percentile(50.0), (unsigned long long)result.latency.value_at_percentile(99.0),
+           (unsigned long long)result.latency.value_at_percentile(99.9), misses.constData());
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    QCommandLineParser cmd_parser;
+    cmd_parser.addHelpOption();
+    QCommandLineOption items_opt("items", "Items moved in every case.", "N", "1000000");
+    QCommandLineOption threads_opt("threads", "Threads on the wide side of N:1, 1:N and N:M cases.", "N", "4");
+    QCommandLineOption capacity_opt("capacity", "Capacity of bounded buffers.", "items", "1024");
+    QCommandLineOption base_opt("base", "Include BaseExchangeBuffer in 1:1 case, it is not synchronized and may break.");
+    cmd_parser.addOptions({items_opt, threads_opt, capacity_opt, base_opt});
+    cmd_parser.process(app);
+    quint64 items = qMax(1ULL, cmd_parser.value(items_opt).toULongLong());
+    int threads = qMax(1, cmd_parser.value(threads_opt).toInt());
+    quint64 capacity = qMax(2ULL, cmd_parser.value(capacity_opt).toULongLong());
+
+    printf("single producer single consumer\n");
+    if(cmd_parser.isSet(base_opt)) report<BaseAdapter>("BaseExchangeBuffer", 1, 1, items, capacity);
+    report<SharedAdapter<SpscExchangeBuffer<BenchItem> > >("SpscExchangeBuffer", 1, 1, items, capacity);
+    report<ValueAdapter<SpscRing<BenchItem> > >("ValueExchangeBuffer/spsc", 1, 1, items, capacity);
+    report<PooledAdapter<SpscRing<PooledNode<BenchItem>*> > >("PooledExchangeBuffer/spsc", 1, 1, items, capacity);
+
+    const int layouts[4][2] = {{1, 1}, {threads, 1}, {1, threads}, {threads, threads}};
+    for(int i = 0; i < 4; ++i) {
+        int producers = layouts[i][0];
+        int consumers = layouts[i][1];
+        printf("%d producers %d consumers\n", producers, consumers);
+        report<SharedAdapter<MpmcExchangeBuffer<BenchItem> > >("MpmcExchangeBuffer", producers, consumers, items, capacity);
+        report<ValueAdapter<MpmcRing<BenchItem> > >("ValueExchangeBuffer/mpmc", producers, consumers, items, capacity);
+        report<PooledAdapter<MpmcRing<PooledNode<BenchItem>*> > >("PooledExchangeBuffer/mpmc", producers, consumers, items, capacity);
+    }
+    return 0;
+}
@@ -0,0 +1,12 @@
+TEMPLATE = app
+TARGET = ExchangeBufferBenchmark
+CONFIG += console
+CONFIG -= app_bundle
+# Both benchmarks share this directory
+MAKEFILE = Makefile.ExchangeBufferBenchmark
+OBJECTS_DIR = .obj/ExchangeBufferBenchmark
+MOC_DIR = .moc/ExchangeBufferBenchmark
+
+include(../DistributedService.pri)
+
+SOURCES += ExchangeBufferBenchmark.cpp
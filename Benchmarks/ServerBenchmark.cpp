@@ -0,0 +1,348 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*Loopback load generator: starts TCPServer in process, opens K client connections from separate thread,
+ * every client keeps window of messages in flight and measures round trip of echoed messages.
+ * With --role server and --role client both sides run as separate processes, each reports its own CPU.
+ * Run is cut at --timeout seconds, clients which failed to connect or dropped are reported.
+ * Usage: ServerBenchmark --connections 64 --messages 10000 --size 256 --window 16 [--framed] [--role both|server|client]*/
+#include <QtCore>
+#include <QtNetwork>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "../server.h"
+
+/*Every line is complete message, line is kept until parser is reset*/
+class BenchLineParser : public IStreamParser {
+public:
+    virtual void reset() {
+        line.clear();
+        end_msg = false;
+    }
+    virtual void parse(QString& str) {
+        line = str.toLatin1();
+        end_msg = true;
+    }
+    virtual void parse(QByteArray& buffer) {
+        line = QByteArray(buffer.constData(), buffer.size());
+        end_msg = true;
+    }
+    virtual bool isEndMsg() {
+        return end_msg;
+    }
+    virtual bool isValidMsg() {
+        return true;
+    }
+    QByteArray line;
+    bool end_msg = false;
+};
+
+/*Server side of one connection, returns every message to its sender*/
+class EchoSession : public QObject {
+    Q_OBJECT
+public:
+    EchoSession(TCPConnection* conn_, const bool framed) : QObject(conn_), conn(conn_), parser(NULL) {
+        if(framed) {
+            conn->set_framing_mode(TCPConnection::LengthPrefixedFraming);
+            connect(conn, SIGNAL(frame_received(quint16, quint16, QByteArray)), this, SLOT(onFrame(quint16, quint16, QByteArray)));
+        }
+        else {
+            parser = new BenchLineParser();
+            conn->setup_buffer_parser(new LineBufferParser(parser));
+            connect(conn, SIGNAL(msg_received()), this, SLOT(onLine()));
+        }
+    }
+private slots:
+    void onFrame(quint16 frame_type, quint16 frame_flags, const QByteArray& payload) {
+        conn->post_frame(payload, frame_type, frame_flags);
+    }
+    void onLine() {
+        conn->post_msg(parser->line);
+    }
+private:
+    TCPConnection* conn;
+    BenchLineParser* parser;
+};
+
+struct BenchConfig {
+    QString host = "127.0.0.1";
+    quint16 port = 18080;
+    int connections = 64;
+    int messages = 10000;
+    int size = 256;
+    int window = 16;
+    bool framed = false;
+    QString role = "both";
+    int timeout_s = 60;
+};
+
+/*Client connection, message starts with send timestamp so round trip is taken from echoed copy*/
+class BenchClient : public QObject {
+    Q_OBJECT
+public:
+    BenchClient(const BenchConfig& config_, LatencyHistogram* histogram_, QObject* parent = NULL) : QObject(parent), config(config_), histogram(histogram_),
+                                                                                                   conn(new TCPConnection(static_cast<IStreamParser*>(NULL), this)), parser(NULL), sent(0), received(0), ended(false) {
+        if(config.framed) {
+            conn->set_framing_mode(TCPConnection::LengthPrefixedFraming);
+            connect(conn, SIGNAL(frame_received(quint16, quint16, QByteArray)), this, SLOT(onFrame(quint16, quint16, QByteArray)));
+        }
+        else {
+            parser = new BenchLineParser();
+            conn->setup_buffer_parser(new LineBufferParser(parser));
+            connect(conn, SIGNAL(msg_received()), this, SLOT(onLine()));
+        }
+        connect(conn->get_socket(), SIGNAL(connected()), this, SLOT(onConnected()));
+        connect(conn->get_socket(), SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(onError()));
+    }
+
+    void start() {
+        conn->connectToHost(config.host, config.port);
+    }
+signals:
+    void finished();
+    /*Connect failed or connection dropped before all echoes came back*/
+    void failed();
+private slots:
+    void onError() {
+        if(ended) return;
+        ended = true;
+        qWarning() << "Benchmark client failed: " << conn->get_socket()->errorString();
+        emit failed();
+    }
+    void onConnected() {
+        while(sent < config.messages && sent - received < config.window) send_next();
+    }
+    void onFrame(quint16, quint16, const QByteArray& payload) {
+        on_echo(payload);
+    }
+    void onLine() {
+        on_echo(parser->line);
+    }
+private:
+    void send_next() {
+        QByteArray msg = QByteArray::number(metrics_now_ns(), 16).rightJustified(16, '0');
+        msg.append(QByteArray(qMax(0, config.size - msg.size() - 1), 'x'));
+        msg.append('\n');
+        if(config.framed)
+            conn->post_frame(msg);
+        else
+            conn->post_msg(msg);
+        ++sent;
+    }
+    void on_echo(const QByteArray& msg) {
+        bool ok = false;
+        qint64 send_time = msg.left(16).toLongLong(&ok, 16);
+        if(ok) histogram->record(metrics_now_ns() - send_time);
+        if(++received == config.messages) {
+            ended = true;
+            emit finished();
+            return;
+        }
+        if(sent < config.messages) send_next();
+    }
+
+    BenchConfig config;
+    LatencyHistogram* histogram;
+    TCPConnection* conn;
+    BenchLineParser* parser;
+    int sent;
+    int received;
+    bool ended;
+};
+
+static qint64 process_cpu_time_us() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return qint64(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static qint64 thread_cpu_time_us() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return qint64(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+/*Runs in client thread, owns all clients, histogram is written by this thread only*/
+class ClientDriver : public QObject {
+    Q_OBJECT
+public:
+    ClientDriver(const BenchConfig& config_) : config(config_), done(0), failed(0), cpu_start_us(0), cpu_used_us(0) {}
+
+    /*Read by main thread after client thread stopped*/
+    LatencyHistogram histogram;
+    int get_done_count() const {
+        return done;
+    }
+    int get_failed_count() const {
+        return failed;
+    }
+    qint64 get_cpu_used_us() const {
+        return cpu_used_us;
+    }
+signals:
+    void all_finished();
+public slots:
+    void run() {
+        cpu_start_us = thread_cpu_time_us();
+        for(int i = 0; i < config.connections; ++i) {
+            BenchClient* client = new BenchClient(config, &histogram, this);
+            connect(client, SIGNAL(finished()), this, SLOT(onClientFinished()));
+            connect(client, SIGNAL(failed()), this, SLOT(onClientFailed()));
+            client->start();
+        }
+    }
+    /*Called in client thread right before it stops*/
+    void stop() {
+        cpu_used_us = thread_cpu_time_us() - cpu_start_us;
+    }
+private slots:
+    void onClientFinished() {
+        ++done;
+        check_all_ended();
+    }
+    void onClientFailed() {
+        ++failed;
+        check_all_ended();
+    }
+private:
+    void check_all_ended() {
+        if(done + failed == config.connections) emit all_finished();
+    }
+    BenchConfig config;
+    int done;
+    int failed;
+    qint64 cpu_start_us;
+    qint64 cpu_used_us;
+};
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    QCommandLineParser cmd_parser;
+    cmd_parser.addHelpOption();
+    QCommandLineOption connections_opt("connections", "Client connections.", "K", "64");
+    QCommandLineOption messages_opt("messages", "Messages per connection.", "N", "10000");
+    QCommandLineOption size_opt("size", "Message size in bytes.", "bytes", "256");
+    QCommandLineOption window_opt("window", "Messages in flight per connection.", "W", "16");
+    QCommandLineOption host_opt("host", "Server address for client role.", "host", "127.0.0.1");
+    QCommandLineOption port_opt("port", "Loopback port.", "port", "18080");
+    QCommandLineOption framed_opt("framed", "Length prefixed frames instead of lines.");
+    QCommandLineOption role_opt("role", "both, server or client.", "role", "both");
+    QCommandLineOption timeout_opt("timeout", "Run is cut after this many seconds.", "seconds", "60");
+    cmd_parser.addOptions({connections_opt, messages_opt, size_opt, window_opt, host_opt, port_opt, framed_opt, role_opt, timeout_opt});
+    cmd_parser.process(app);
+
+    BenchConfig config;
+    config.connections = qMax(1, cmd_parser.value(connections_opt).toInt());
+    config.messages = qMax(1, cmd_parser.value(messages_opt).toInt());
+    config.size = qMax(17, cmd_parser.value(size_opt).toInt());
+    config.window = qMax(1, cmd_parser.value(window_opt).toInt());
+    config.host = cmd_parser.value(host_opt);
+    config.port = quint16(cmd_parser.value(port_opt).toUInt());
+    config.framed = cmd_parser.isSet(framed_opt);
+    config.role = cmd_parser.value(role_opt);
+    config.timeout_s = qMax(1, cmd_parser.value(timeout_opt).toInt());
+    if(config.role != "both" && config.role != "server" && config.role != "client") {
+        fprintf(stderr, "unknown role %s\n", qPrintable(config.role));
+        return 1;
+    }
+    bool run_server = config.role != "client";
+    bool run_clients = config.role != "server";
+    double expected_msgs = double(config.connections) * config.messages;
+
+    QScopedPointer<TCPServer> server;
+    if(run_server) {
+        server.reset(new TCPServer(config.port));
+        if(!server->isListening()) return 1;
+        TCPServer* server_ptr = server.data();
+        QObject::connect(server_ptr, &TCPServer::connection_accepted, [server_ptr, &config](quint64 conn_id) {
+            QSharedPointer<TCPConnection> conn = server_ptr->get_conn_ptr(conn_id);
+            if(!conn.isNull()) new EchoSession(conn.data(), config.framed);
+        });
+    }
+
+    QThread client_thread;
+    ClientDriver* driver = NULL;
+    if(run_clients) {
+        driver = new ClientDriver(config);
+        driver->moveToThread(&client_thread);
+        QObject::connect(&client_thread, SIGNAL(finished()), driver, SLOT(deleteLater()));
+    }
+    QElapsedTimer wall_clock;
+    /*Server runs in main thread, in both role its CPU is taken per thread to keep it apart from clients*/
+    qint64 server_cpu_start = 0;
+    qint64 process_cpu_start = 0;
+    bool reported = false;
+    int exit_code = 0;
+    auto report = [&](const bool timed_out) {
+        if(reported) return;
+        reported = true;
+        double elapsed_s = wall_clock.nsecsElapsed() / 1e9;
+        qint64 server_cpu_us = thread_cpu_time_us() - server_cpu_start;
+        qint64 process_cpu_us = process_cpu_time_us() - process_cpu_start;
+        printf("connections %d, message %d bytes, %s, window %d, role %s\n", config.connections, config.size, config.framed ? "frames" : "lines",
+               config.window, qPrintable(config.role));
+        if(timed_out) printf("run cut by %d s timeout\n", config.timeout_s);
+        if(run_clients) {
+            QMetaObject::invokeMethod(driver, "stop", Qt::BlockingQueuedConnection);
+            client_thread.quit();
+            client_thread.wait();
+            HistogramSnapshot latency;
+            driver->histogram.snapshot(latency);
+            double round_trips = double(latency.total_count);
+            int unfinished = config.connections - driver->get_done_count() - driver->get_failed_count();
+            printf("clients: %d finished, %d failed, %d unfinished\n", driver->get_done_count(), driver->get_failed_count(), unfinished);
+            printf("round trips %.0f of %.0f in %.3f s: %.0f msg/s, %.2f MB/s each way\n", round_trips, expected_msgs, elapsed_s, round_trips / elapsed_s,
+                   round_trips * config.size / elapsed_s / 1e6);
+            printf("latency us: p50 %.1f, p99 %.1f, p999 %.1f, max %.1f\n", latency.value_at_percentile(50.0) / 1e3, latency.value_at_percentile(99.0) / 1e3,
+                   latency.value_at_percentile(99.9) / 1e3, latency.max_value / 1e3);
+            qint64 client_cpu_us = run_server ? driver->get_cpu_used_us() : process_cpu_us;
+            if(round_trips > 0) printf("client cpu per round trip: %.2f us\n", client_cpu_us / round_trips);
+            if(driver->get_failed_count() > 0 || unfinished > 0) exit_code = 2;
+        }
+        if(run_server) {
+            MetricsSnapshot server_metrics = server->get_metrics_snapshot();
+            qint64 cpu_us = run_clients ? server_cpu_us : process_cpu_us;
+            if(server_metrics.msgs_in > 0) printf("server cpu per message: %.2f us\n", cpu_us / double(server_metrics.msgs_in));
+            printf("server: msgs in %llu, parse errors %llu, receive to msg_received p99 %.1f us\n", (unsigned long long)server_metrics.msgs_in,
+                   (unsigned long long)server_metrics.parse_errors, server_metrics.receive_latency.value_at_percentile(99.0) / 1e3);
+            if(!run_clients && server_metrics.msgs_in < quint64(expected_msgs)) exit_code = 2;
+        }
+        app.exit(exit_code);
+    };
+    if(run_clients) {
+        QObject::connect(driver, &ClientDriver::all_finished, &app, [&]() { report(false); }, Qt::QueuedConnection);
+    }
+    else {
+        /*Server alone stops once it has echoed everything clients are going to send*/
+        QTimer* progress_timer = new QTimer(&app);
+        QObject::connect(progress_timer, &QTimer::timeout, [&]() {
+            if(server->get_metrics_snapshot().msgs_in >= quint64(expected_msgs)) report(false);
+        });
+        progress_timer->start(100);
+    }
+    QTimer::singleShot(config.timeout_s * 1000, &app, [&]() { report(true); });
+    if(run_clients) client_thread.start();
+    server_cpu_start = thread_cpu_time_us();
+    process_cpu_start = process_cpu_time_us();
+    wall_clock.start();
+    if(run_clients) QMetaObject::invokeMethod(driver, "run", Qt::QueuedConnection);
+    return app.exec();
+}
+
+#include "ServerBenchmark.moc"
@@ -0,0 +1,12 @@
+TEMPLATE = app
+TARGET = ServerBenchmark
+CONFIG += console
+CONFIG -= app_bundle
+# Both benchmarks share this directory
+MAKEFILE = Makefile.ServerBenchmark
+OBJECTS_DIR = .obj/ServerBenchmark
+MOC_DIR = .moc/ServerBenchmark
+
+include(../DistributedService.pri)
+
+SOURCES += ServerBenchmark.cpp
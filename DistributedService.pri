@@ -0,0 +1,32 @@
+# Header only networking core, projects using it include this file so moc runs on its QObject classes
+QT += core network
+CONFIG += c++14 thread
+
+INCLUDEPATH += $$PWD
+
+HEADERS += \
+    $$PWD/IExchangeBuffer.h \
+    $$PWD/connection.h \
+    $$PWD/connpool.h \
+    $$PWD/connregistry.h \
+    $$PWD/epolltransport.h \
+    $$PWD/framing.h \
+    $$PWD/localtransport.h \
+    $$PWD/lzcodec.h \
+    $$PWD/metrics.h \
+    $$PWD/msgcodec.h \
+    $$PWD/msgregistry.h \
+    $$PWD/ratelimiter.h \
+    $$PWD/readbuffer.h \
+    $$PWD/rwlock.h \
+    $$PWD/sendqueue.h \
+    $$PWD/server.h \
+    $$PWD/sessionexecutor.h \
+    $$PWD/shmring.h \
+    $$PWD/streammux.h \
+    $$PWD/subnettrie.h \
+    $$PWD/timerwheel.h \
+    $$PWD/tlssessioncache.h
+
+# POSIX shared memory lives in librt on older glibc
+linux: LIBS += -lrt
@@ -0,0 +1,6 @@
+TEMPLATE = subdirs
+
+server_benchmark.file = Benchmarks/ServerBenchmark.pro
+exchange_buffer_benchmark.file = Benchmarks/ExchangeBufferBenchmark.pro
+
+SUBDIRS += server_benchmark exchange_buffer_benchmark
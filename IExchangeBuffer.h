@@ -21,8 +21,16 @@ SOFTWARE.
 #pragma once
 #include <QSharedPointer>
 #include <QQueue>
+#include <QVector>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
 
 #include <atomic>
+#include <utility>
+
+#define CACHE_LINE_SIZE 64
+#define DEFAULT_RING_CAPACITY 1024
 
 template<class T>
 class IExchangeBuffer {
@@ -100,4 +108,438 @@ private:
     QQueue<QSharedPointer<T>> second_queue;
 };
 
+inline quint64 ring_capacity(const quint64 capacity) {
+    quint64 size = 2;
+    while(size < capacity) size <<= 1;
+    return size;
+}
+
+/*Bounded single producer single consumer ring of values, capacity is power of two.
+ * Head is written by producer only and tail by consumer only, each index lives on its own cache line
+ * together with owner's cached copy of opposite index, so shared lines are touched only when cached copy runs out*/
+template<class V>
+class SpscRing {
+public:
+    SpscRing(const quint64 capacity = DEFAULT_RING_CAPACITY) : mask(ring_capacity(capacity) - 1), cells(new V[mask + 1]),
+                                                              head(0), cached_tail(0), tail(0), cached_head(0) {}
+    virtual ~SpscRing() {
+        delete[] cells;
+    }
+
+    /*Producer side*/
+    bool try_push(const V& value) {
+        quint64 head_pos = head.load(std::memory_order_relaxed);
+        if(head_pos - cached_tail > mask) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if(head_pos - cached_tail > mask) return false;
+        }
+        cells[head_pos & mask] = value;
+        head.store(head_pos + 1, std::memory_order_release);
+        return true;
+    }
+    bool try_push(V&& value) {
+        quint64 head_pos = head.load(std::memory_order_relaxed);
+        if(head_pos - cached_tail > mask) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if(head_pos - cached_tail > mask) return false;
+        }
+        cells[head_pos & mask] = std::move(value);
+        head.store(head_pos + 1, std::memory_order_release);
+        return true;
+    }
+    /*Consumer side, slot is left in moved from state*/
+    bool try_pop(V& value) {
+        quint64 tail_pos = tail.load(std::memory_order_relaxed);
+        if(tail_pos == cached_head) {
+            cached_head = head.load(std::memory_order_acquire);
+            if(tail_pos == cached_head) return false;
+        }
+        value = std::move(cells[tail_pos & mask]);
+        tail.store(tail_pos + 1, std::memory_order_release);
+        return true;
+    }
+    quint64 get_capacity() const {
+        return mask + 1;
+    }
+    /*Exact only when both sides are idle*/
+    quint64 size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+    bool isEmpty() const {
+        return size() == 0;
+    }
+private:
+    SpscRing(const SpscRing&);
+    SpscRing& operator = (const SpscRing&);
+
+    const quint64 mask;
+    V* const cells;
+    alignas(CACHE_LINE_SIZE) std::atomic<quint64> head;
+    quint64 cached_tail;
+    alignas(CACHE_LINE_SIZE) std::atomic<quint64> tail;
+    quint64 cached_head;
+    char tail_pad[CACHE_LINE_SIZE - sizeof(std::atomic<quint64>) - sizeof(quint64)];
+};
+
+/*Hand off from one producer thread to one consumer thread without locks and without allocation per item.
+ * add_item returns false when ring is full, item stays with caller then*/
+template<class T>
+class SpscExchangeBuffer : public IExchangeBuffer<T> {
+public:
+    SpscExchangeBuffer(const quint64 capacity = DEFAULT_RING_CAPACITY) : ring(capacity) {}
+    virtual ~SpscExchangeBuffer() {}
+
+    /*Drops queued items, has to be called while neither side is working*/
+    virtual void reset() {
+        QSharedPointer<T> item;
+        while(ring.try_pop(item)) {
+            item.reset();
+        }
+    }
+    virtual bool try_to_read_item(QSharedPointer<T>& item) {
+        return ring.try_pop(item);
+    }
+    virtual bool add_item(QSharedPointer<T>& item) {
+        return ring.try_push(item);
+    }
+    quint64 get_capacity() const {
+        return ring.get_capacity();
+    }
+    quint64 size() const {
+        return ring.size();
+    }
+private:
+    SpscRing<QSharedPointer<T> > ring;
+};
+
+/*Bounded multi producer multi consumer ring of values (D. Vyukov's scheme): every cell carries sequence number
+ * telling whether it is free or published for given position, producers and consumers claim positions by CAS
+ * on their own cache line. Batch methods check run of cells first and claim all of them with one CAS*/
+template<class V>
+class MpmcRing {
+    struct Cell {
+        std::atomic<quint64> sequence;
+        V value;
+    };
+public:
+    MpmcRing(const quint64 capacity = DEFAULT_RING_CAPACITY) : mask(ring_capacity(capacity) - 1), cells(new Cell[mask + 1]),
+                                                              enqueue_pos(0), dequeue_pos(0) {
+        for(quint64 i = 0; i <= mask; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    virtual ~MpmcRing() {
+        delete[] cells;
+    }
+
+    bool try_push(const V& value) {
+        V copy(value);
+        return try_push(std::move(copy));
+    }
+    bool try_push(V&& value) {
+        quint64 pos = 0;
+        if(claim(enqueue_pos, 0, 1, pos) == 0) return false;
+        Cell& cell = cells[pos & mask];
+        cell.value = std::move(value);
+        cell.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    bool try_pop(V& value) {
+        quint64 pos = 0;
+        if(claim(dequeue_pos, 1, 1, pos) == 0) return false;
+        Cell& cell = cells[pos & mask];
+        value = std::move(cell.value);
+        cell.sequence.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+    /*Returns count of values taken from the front of values*/
+    int try_push_many(const V* values, const int count) {
+        quint64 pos = 0;
+        int claimed = claim(enqueue_pos, 0, count, pos);
+        for(int i = 0; i < claimed; ++i) {
+            Cell& cell = cells[(pos + i) & mask];
+            cell.value = values[i];
+            cell.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        return claimed;
+    }
+    int try_pop_many(V* values, const int count) {
+        quint64 pos = 0;
+        int claimed = claim(dequeue_pos, 1, count, pos);
+        for(int i = 0; i < claimed; ++i) {
+            Cell& cell = cells[(pos + i) & mask];
+            values[i] = std::move(cell.value);
+            cell.sequence.store(pos + i + mask + 1, std::memory_order_release);
+        }
+        return claimed;
+    }
+    /*Published item is waiting at front, hint for waiters only*/
+    bool has_item() const {
+        quint64 pos = dequeue_pos.load(std::memory_order_acquire);
+        return qint64(cells[pos & mask].sequence.load(std::memory_order_acquire) - (pos + 1)) >= 0;
+    }
+    /*Free cell is waiting at back, hint for waiters only*/
+    bool has_space() const {
+        quint64 pos = enqueue_pos.load(std::memory_order_acquire);
+        return qint64(cells[pos & mask].sequence.load(std::memory_order_acquire) - pos) >= 0;
+    }
+    quint64 get_capacity() const {
+        return mask + 1;
+    }
+    quint64 size() const {
+        quint64 enqueued = enqueue_pos.load(std::memory_order_acquire);
+        quint64 dequeued = dequeue_pos.load(std::memory_order_acquire);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+private:
+    MpmcRing(const MpmcRing&);
+    MpmcRing& operator = (const MpmcRing&);
+
+    /*Claim up to count consecutive cells ready for side (offset 0 for producers, 1 for consumers),
+     * returns count of claimed cells starting at pos*/
+    int claim(std::atomic<quint64>& position, const quint64 offset, const int count, quint64& pos) {
+        pos = position.load(std::memory_order_relaxed);
+        while(true) {
+            qint64 diff = qint64(cells[pos & mask].sequence.load(std::memory_order_acquire) - (pos + offset));
+            if(diff < 0) return 0;
+            if(diff > 0) {
+                /*Position was claimed by another thread of the same side*/
+                pos = position.load(std::memory_order_relaxed);
+                continue;
+            }
+            int ready = 1;
+            while(ready < count && cells[(pos + ready) & mask].sequence.load(std::memory_order_acquire) == pos + ready + offset) ++ready;
+            if(position.compare_exchange_weak(pos, pos + ready, std::memory_order_relaxed)) return ready;
+        }
+    }
+
+    const quint64 mask;
+    Cell* const cells;
+    alignas(CACHE_LINE_SIZE) std::atomic<quint64> enqueue_pos;
+    alignas(CACHE_LINE_SIZE) std::atomic<quint64> dequeue_pos;
+    char dequeue_pad[CACHE_LINE_SIZE - sizeof(std::atomic<quint64>)];
+};
+
+/*Several connection threads feeding pool of workers. Besides non blocking IExchangeBuffer methods it offers
+ * batch transfer and blocking waits with timeout (negative timeout waits forever). Waiting threads sleep on
+ * condition variable, producers and consumers take its mutex only when somebody is waiting*/
+template<class T>
+class MpmcExchangeBuffer : public IExchangeBuffer<T> {
+public:
+    MpmcExchangeBuffer(const quint64 capacity = DEFAULT_RING_CAPACITY) : ring(capacity), read_waiters(0), write_waiters(0) {}
+    virtual ~MpmcExchangeBuffer() {}
+
+    /*Drops queued items, has to be called while nobody is working with buffer*/
+    virtual void reset() {
+        QSharedPointer<T> item;
+        while(ring.try_pop(item)) {
+            item.reset();
+        }
+    }
+    virtual bool try_to_read_item(QSharedPointer<T>& item) {
+        if(!ring.try_pop(item)) return false;
+        notify(write_waiters, not_full, 1);
+        return true;
+    }
+    virtual bool add_item(QSharedPointer<T>& item) {
+        if(!ring.try_push(item)) return false;
+        notify(read_waiters, not_empty, 1);
+        return true;
+    }
+    /*Append up to count items to items, returns count of read items*/
+    int try_to_read_items(QVector<QSharedPointer<T> >& items, const int count) {
+        if(count <= 0) return 0;
+        int offset = items.size();
+        items.resize(offset + count);
+        int read = ring.try_pop_many(items.data() + offset, count);
+        items.resize(offset + read);
+        if(read > 0) notify(write_waiters, not_full, read);
+        return read;
+    }
+    /*Add front part of items which fits into buffer, returns count of added items*/
+    int add_items(const QSharedPointer<T>* items, const int count) {
+        if(count <= 0) return 0;
+        int added = ring.try_push_many(items, count);
+        if(added > 0) notify(read_waiters, not_empty, added);
+        return added;
+    }
+    int add_items(const QVector<QSharedPointer<T> >& items) {
+        return add_items(items.constData(), items.size());
+    }
+    /*Wait until item is available, another consumer may still take it first*/
+    bool wait_read(const int timeout_ms = -1) {
+        return wait(read_waiters, not_empty, timeout_ms, &MpmcRing<QSharedPointer<T> >::has_item);
+    }
+    /*Wait until there is space for item, another producer may still take it first*/
+    bool wait_write(const int timeout_ms = -1) {
+        return wait(write_waiters, not_full, timeout_ms, &MpmcRing<QSharedPointer<T> >::has_space);
+    }
+    quint64 get_capacity() const {
+        return ring.get_capacity();
+    }
+    quint64 size() const {
+        return ring.size();
+    }
+private:
+    typedef bool (MpmcRing<QSharedPointer<T> >::*ReadyCheck)() const;
+
+    bool wait(std::atomic<int>& waiters, QWaitCondition& condition, const int timeout_ms, ReadyCheck is_ready) {
+        if((ring.*is_ready)()) return true;
+        if(timeout_ms == 0) return false;
+        QElapsedTimer timer;
+        timer.start();
+        QMutexLocker locker(&wait_lock);
+        waiters.fetch_add(1);
+        /*Pairs with fence in notify: either waiter sees new state or notifier sees waiter*/
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while(!(ring.*is_ready)()) {
+            if(timeout_ms < 0) {
+                condition.wait(&wait_lock);
+                continue;
+            }
+            qint64 left = timeout_ms - timer.elapsed();
+            if(left <= 0) break;
+            condition.wait(&wait_lock, (unsigned long)left);
+        }
+        waiters.fetch_sub(1);
+        return (ring.*is_ready)();
+    }
+    void notify(std::atomic<int>& waiters, QWaitCondition& condition, const int count) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(waiters.load(std::memory_order_relaxed) == 0) return;
+        QMutexLocker locker(&wait_lock);
+        if(count > 1)
+            condition.wakeAll();
+        else
+            condition.wakeOne();
+    }
+
+    MpmcRing<QSharedPointer<T> > ring;
+    std::atomic<int> read_waiters;
+    std::atomic<int> write_waiters;
+    QMutex wait_lock;
+    QWaitCondition not_empty;
+    QWaitCondition not_full;
+};
+
+/*Exchange buffer moving items by value, no shared ownership and no allocation per item.
+ * add_item moves item into buffer only on success*/
+template<class V>
+class IValueExchangeBuffer {
+public:
+    virtual ~IValueExchangeBuffer() {}
+
+    virtual bool try_to_read_item(V& item) = 0;
+    virtual bool add_item(V& item) = 0;
+};
+
+/*Ring can be SpscRing<V> for one producer and one consumer or MpmcRing<V> for several of them*/
+template<class V, class Ring = MpmcRing<V> >
+class ValueExchangeBuffer : public IValueExchangeBuffer<V> {
+public:
+    ValueExchangeBuffer(const quint64 capacity = DEFAULT_RING_CAPACITY) : ring(capacity) {}
+    virtual ~ValueExchangeBuffer() {}
+
+    virtual bool try_to_read_item(V& item) {
+        return ring.try_pop(item);
+    }
+    virtual bool add_item(V& item) {
+        return ring.try_push(std::move(item));
+    }
+    bool add_item(V&& item) {
+        return ring.try_push(std::move(item));
+    }
+    quint64 get_capacity() const {
+        return ring.get_capacity();
+    }
+    quint64 size() const {
+        return ring.size();
+    }
+private:
+    Ring ring;
+};
+
+template<class T> class NodePool;
+
+/*Node of NodePool, value is reused by next owner as it was left, so it keeps its buffers*/
+template<class T>
+struct PooledNode {
+    PooledNode() : pool(NULL) {}
+
+    inline void release();
+
+    T value;
+    NodePool<T>* pool;
+};
+
+/*Fixed set of nodes allocated at once, free nodes are kept in MPMC ring of pointers which serves as ABA safe free list.
+ * acquire returns NULL when all nodes are in use, caller decides whether to wait or to drop*/
+template<class T>
+class NodePool {
+public:
+    NodePool(const quint64 capacity = DEFAULT_RING_CAPACITY) : nodes(new PooledNode<T>[ring_capacity(capacity)]), free_nodes(capacity) {
+        for(quint64 i = 0; i < free_nodes.get_capacity(); ++i) {
+            nodes[i].pool = this;
+            free_nodes.try_push(&nodes[i]);
+        }
+    }
+    virtual ~NodePool() {
+        delete[] nodes;
+    }
+
+    PooledNode<T>* acquire() {
+        PooledNode<T>* node = NULL;
+        return free_nodes.try_pop(node) ? node : NULL;
+    }
+    void release(PooledNode<T>* node) {
+        free_nodes.try_push(node);
+    }
+    quint64 get_capacity() const {
+        return free_nodes.get_capacity();
+    }
+    quint64 get_free_count() const {
+        return free_nodes.size();
+    }
+private:
+    NodePool(const NodePool&);
+    NodePool& operator = (const NodePool&);
+
+    PooledNode<T>* nodes;
+    MpmcRing<PooledNode<T>*> free_nodes;
+};
+
+template<class T>
+inline void PooledNode<T>::release() {
+    pool->release(this);
+}
+
+/*Ownership of pooled node passes from producer to consumer by pointer: producer takes node from pool and fills it,
+ * consumer reads it and releases it back. Neither side allocates nor touches reference counters*/
+template<class T, class Ring = MpmcRing<PooledNode<T>*> >
+class PooledExchangeBuffer : public IValueExchangeBuffer<PooledNode<T>*> {
+public:
+    /*Pool holds capacity nodes, so buffer can never overflow with nodes of its own pool*/
+    PooledExchangeBuffer(const quint64 capacity = DEFAULT_RING_CAPACITY) : pool(capacity), ring(capacity) {}
+    virtual ~PooledExchangeBuffer() {}
+
+    PooledNode<T>* acquire_node() {
+        return pool.acquire();
+    }
+    virtual bool try_to_read_item(PooledNode<T>*& node) {
+        return ring.try_pop(node);
+    }
+    virtual bool add_item(PooledNode<T>*& node) {
+        return ring.try_push(node);
+    }
+    quint64 get_free_count() const {
+        return pool.get_free_count();
+    }
+    quint64 size() const {
+        return ring.size();
+    }
+private:
+    NodePool<T> pool;
+    Ring ring;
+};
+
 #endif // IEXCHANGEBUFFER
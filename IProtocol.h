@@ -20,6 +20,7 @@ SOFTWARE.
 #define IPROTOCOL_H
 #pragma once
 #include <QtCore>
+#include "timerwheel.h"
 
 class IMsgPacket {
 public:
@@ -36,31 +37,158 @@ public:
     virtual bool create_msg(const QString& msg_type, IMsgPacket& msg_packet) = 0;
 };
 
+#define DEFAULT_QUESTIONNAIRE_RESERVE 32
+
+/*Process wide table of questionnaire keys, key names come from protocol definitions so table stays small.
+ * Intern keys once, e.g. into static constants, and use ids on hot paths*/
+class QuestionnaireKeys {
+public:
+    static quint32 intern(const QString& name) {
+        QuestionnaireKeys& keys = instance();
+        {
+            QReadLocker locker(&keys.lock);
+            QHash<QString, quint32>::const_iterator iter = keys.ids.constFind(name);
+            if(iter != keys.ids.constEnd()) return iter.value();
+        }
+        QWriteLocker locker(&keys.lock);
+        QHash<QString, quint32>::const_iterator iter = keys.ids.constFind(name);
+        if(iter != keys.ids.constEnd()) return iter.value();
+        quint32 key = quint32(keys.names.size());
+        keys.names.append(name);
+        keys.ids.insert(name, key);
+        return key;
+    }
+    /*Lookup without inserting, names coming from peers must not grow the table*/
+    static bool find(const QString& name, quint32* key) {
+        QuestionnaireKeys& keys = instance();
+        QReadLocker locker(&keys.lock);
+        QHash<QString, quint32>::const_iterator iter = keys.ids.constFind(name);
+        if(iter == keys.ids.constEnd()) return false;
+        *key = iter.value();
+        return true;
+    }
+    static QString name(const quint32 key) {
+        QuestionnaireKeys& keys = instance();
+        QReadLocker locker(&keys.lock);
+        return keys.names.value(int(key));
+    }
+private:
+    static QuestionnaireKeys& instance() {
+        static QuestionnaireKeys keys;
+        return keys;
+    }
+
+    QReadWriteLock lock;
+    QHash<QString, quint32> ids;
+    QVector<QString> names;
+};
+
+/*Session scoped store of retrieved fields: values of all fields sit in one vector in arrival order,
+ * field is a range of it. Reset drops everything at once and keeps capacity for the next session*/
 struct Questionnaire {
+    struct Entry {
+        Entry() : key(0) {}
+        Entry(const quint32 key_, const QVariant& value_) : key(key_), value(value_) {}
+        quint32 key;
+        QVariant value;
+    };
+    /*View of values retrieved from one message, valid until questionnaire is modified*/
     struct QuestionnaireField {
-        virtual ~QuestionnaireField() {
-            reset();
-        }
+        QuestionnaireField() : msg_id(0), first(NULL), last(NULL) {}
+        QuestionnaireField(const unsigned int msg_id_, const Entry* first_, const Entry* last_) : msg_id(msg_id_), first(first_), last(last_) {}
 
-        void reset() {
-            if(!fields.isEmpty()) fields.clear();
+        int size() const {
+            return int(last - first);
+        }
+        const Entry* begin() const {
+            return first;
+        }
+        const Entry* end() const {
+            return last;
+        }
+        const QVariant* find(const quint32 key) const {
+            for(const Entry* entry = first; entry != last; ++entry) {
+                if(entry->key == key) return &entry->value;
+            }
+            return NULL;
+        }
+        QVariant value(const QString& key) const {
+            quint32 key_id = 0;
+            if(!QuestionnaireKeys::find(key, &key_id)) return QVariant();
+            const QVariant* found = find(key_id);
+            return found ? *found : QVariant();
         }
         unsigned int msg_id;
-        QMap<QString, QVariant> fields;
+        const Entry* first;
+        const Entry* last;
     };
-    virtual ~Questionnaire() {
-        reset();
+    Questionnaire(const int reserve = DEFAULT_QUESTIONNAIRE_RESERVE) {
+        entries.reserve(reserve);
     }
+    virtual ~Questionnaire() {}
 
-    void reset() {
-        if(fields_store.isEmpty()) return;
-
-        foreach(QSharedPointer<QuestionnaireField> field_ptr, fields_store) {
-            field_ptr->reset();
+    /*Starts field of next message, following set_value calls go into it*/
+    void add_field(const unsigned int msg_id) {
+        Range range;
+        range.msg_id = msg_id;
+        range.first = entries.size();
+        ranges.append(range);
+    }
+    void add_field(const unsigned int msg_id, const QMap<QString, QVariant>& values) {
+        add_field(msg_id);
+        for(QMap<QString, QVariant>::const_iterator iter = values.constBegin(); iter != values.constEnd(); ++iter) {
+            entries.append(Entry(QuestionnaireKeys::intern(iter.key()), iter.value()));
         }
-        fields_store.clear();
     }
-    QLinkedList<QSharedPointer<QuestionnaireField> > fields_store;
+    /*Value with the same key in current field is replaced*/
+    bool set_value(const quint32 key, const QVariant& value) {
+        if(ranges.isEmpty()) return false;
+        for(int i = ranges.last().first; i < entries.size(); ++i) {
+            if(entries[i].key != key) continue;
+            entries[i].value = value;
+            return true;
+        }
+        entries.append(Entry(key, value));
+        return true;
+    }
+    bool set_value(const QString& key, const QVariant& value) {
+        return set_value(QuestionnaireKeys::intern(key), value);
+    }
+    int get_field_count() const {
+        return ranges.size();
+    }
+    QuestionnaireField get_field(const int index) const {
+        const Entry* base = entries.constData();
+        int last = index + 1 < ranges.size() ? ranges[index + 1].first : entries.size();
+        return QuestionnaireField(ranges[index].msg_id, base + ranges[index].first, base + last);
+    }
+    /*Latest value of key retrieved from message msg_id*/
+    const QVariant* find_value(const unsigned int msg_id, const quint32 key) const {
+        for(int i = ranges.size() - 1; i >= 0; --i) {
+            if(ranges[i].msg_id != msg_id) continue;
+            const QVariant* found = get_field(i).find(key);
+            if(found) return found;
+        }
+        return NULL;
+    }
+    /*Linear pass over all values in arrival order*/
+    const Entry* begin() const {
+        return entries.constBegin();
+    }
+    const Entry* end() const {
+        return entries.constEnd();
+    }
+    void reset() {
+        entries.resize(0);
+        ranges.resize(0);
+    }
+private:
+    struct Range {
+        unsigned int msg_id;
+        int first;
+    };
+    QVector<Entry> entries;
+    QVector<Range> ranges;
 };
 
 class ISessionStates {
@@ -83,9 +211,14 @@ private:
     QSharedPointer<Questionnaire> msgs_info_ptr;
 };
 
-class BaseProtocol {
+/*Session deadline of Ignore state is armed on shared timer wheel instead of per session QTimer,
+ * wheel has to live in thread the protocol is driven from*/
+class BaseProtocol : public ITimerHandler {
 public:
-    virtual ~BaseProtocol() {}
+    BaseProtocol() : timer_wheel(NULL), session_timer(0), timed_out(false) {}
+    virtual ~BaseProtocol() {
+        cancel_session_timer();
+    }
 
     void set_protocol_id(const QString protocol_id_) {
         protocol_id = protocol_id_;
@@ -99,28 +232,62 @@ public:
     const QSharedPointer<ISessionStates> get_state_holder() const {
         return state_ptr;
     }
+    void set_timer_wheel(TimerWheel* timer_wheel_) {
+        cancel_session_timer();
+        timer_wheel = timer_wheel_;
+    }
+    bool is_timed_out() const {
+        return timed_out;
+    }
     virtual bool set_new_msg(const QSharedPointer<IMsgPacket> received_msg, QByteArray& send_msg, long& timeout) {
         ISessionStates::State new_state;
         if(!state_ptr->calc_new_state(received_msg, new_state)) return false;
+        timed_out = false;
         switch(new_state) {
         case ISessionStates::Listen:
             if(!send_msg.isEmpty()) send_msg.clear();
             timeout = 0;
+            cancel_session_timer();
             break;
         case ISessionStates::Speak:
+            cancel_session_timer();
             if(!state_ptr->get_new_msg(send_msg)) return false;
             break;
         case ISessionStates::Ignore:
             timeout = state_ptr->get_timeout();
+            arm_session_timer(timeout);
             break;
         default:
             break;
         }
         return true;
     }
+    virtual void on_timer_expired(const quint64) {
+        session_timer = 0;
+        timed_out = true;
+        on_session_timeout();
+    }
+protected:
+    /*Called from timer wheel when session stayed in Ignore state longer than its timeout*/
+    virtual void on_session_timeout() {}
+    void arm_session_timer(const long timeout) {
+        if(timer_wheel == NULL) return;
+        if(timeout <= 0) {
+            cancel_session_timer();
+            return;
+        }
+        if(!timer_wheel->rearm(session_timer, timeout)) session_timer = timer_wheel->arm(timeout, this);
+    }
+    void cancel_session_timer() {
+        if(timer_wheel != NULL && session_timer != 0) timer_wheel->cancel(session_timer);
+        session_timer = 0;
+    }
 private:
     QString protocol_id;
     QSharedPointer<ISessionStates> state_ptr;
+    TimerWheel* timer_wheel;
+    TimerWheel::TimerId session_timer;
+    bool timed_out;
 };
 
 #endif // IPROTOCOL_H
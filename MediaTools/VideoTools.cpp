@@ -24,6 +24,7 @@ namespace MediaTools {
 
 VideoTools::VideoTools(QObject* parent, const char* outfile) : QObject(parent) {
     this->pause = false;
+    this->throttled = false;
     videoSource = new VideoProvider();
     cv::Mat image;
     videoSource->getNextImage(image);
@@ -129,6 +130,9 @@ void VideoTools::codeFrames() {
             }
             usleep(100);
         }
+        while(this->throttled) {
+            usleep(100);
+        }
         temp_buff.clear();
         cv::Mat image;
         if (!end_of_stream) {
@@ -40,6 +40,14 @@ public slots:
             usleep(50);
         }
     }
+    /*Backpressure from connection write_paused/write_resumed, encoding is held while suspended.
+     * codeFrames keeps thread busy, so these slots have to be connected with Qt::DirectConnection*/
+    void suspend() {
+        this->throttled = true;
+    }
+    void resume() {
+        this->throttled = false;
+    }
 signals:
     void getFrame();
 protected:
@@ -68,6 +76,7 @@ private:
     int cnum = 0;
 
     std::atomic<bool> pause;
+    std::atomic<bool> throttled;
 
     QByteArray temp_buff;
 };
@@ -28,7 +28,6 @@ SOFTWARE.
 #include <iostream>
 #include <csignal>
 #include <stdio.h>
-#include <pthread.h>
 #include <unistd.h>
 
 #include <QTcpServer>
@@ -37,12 +36,15 @@ SOFTWARE.
 #include <QTime>
 #include <QHostInfo>
 
+#include "connpool.h"
+#include "rwlock.h"
+
 #define DEFAULT_MESSAGE_SIZE 2048
 
 struct Message;
 
 template<typename T>
-class RemoteDataWraper : public QObject {
+class RemoteDataWraper : public QObject, public IPoolWaiter {
 public:
     enum State {
         blocked = 0,
@@ -55,12 +57,10 @@ public:
         control_message,
         data_message
     };
-    RemoteDataWraper(QObject* parent = 0) : QObject(parent), connection_to_remote_server(new QTcpSocket(this)),
-                                            data_ptr(0), data_size(0) {
+    RemoteDataWraper(QObject* parent = 0) : QObject(parent), data_ptr(0), data_size(0) {
         state = readable;
     }
-    RemoteDataWraper(T* data_ptr_, size_t size = 0, QObject* parent = 0) : QObject(parent),
-                                  connection_to_remote_server(new QTcpSocket(this)), data_ptr(data_ptr_) {
+    RemoteDataWraper(T* data_ptr_, size_t size = 0, QObject* parent = 0) : QObject(parent), data_ptr(data_ptr_) {
         state = readable;
         if(size == 0)
             data_size = (sizeof(data_ptr)/sizeof(*data_ptr));
@@ -99,7 +99,24 @@ public:
     size_t size() {
         return data_size;
     }
+    /*Wrappers using the same pool reuse sockets to the same server instead of opening one socket per object,
+     * socket is leased to one wrapper at a time since replies on it are read without demultiplexing,
+     * wrapper finding all sockets leased waits in pool queue until one is released*/
+    void set_connection_pool(ConnectionPool* connection_pool_) {
+        connection_pool = connection_pool_;
+    }
     void connect_to_remote_server(const QString host, const int port) {
+        if(connection_pool != nullptr) {
+            release_connection();
+            QTcpSocket* socket = connection_pool->acquire(host, port, this);
+            if(socket == nullptr) {
+                qDebug() << "All pooled connections to server are leased, waiting: " << host << ":" << port;
+                return;
+            }
+            on_socket_leased(socket);
+            return;
+        }
+        if(connection_to_remote_server == nullptr) connection_to_remote_server = new QTcpSocket(this);
         connection_to_remote_server->abort();
         connection_to_remote_server->setReadBufferSize(DEFAULT_MESSAGE_SIZE);
         connect(connection_to_remote_server, SIGNAL(connected()), this, SLOT(connected()));
@@ -161,6 +178,10 @@ public slots:
     }
     void disconnected() {
         qDebug() << "Connection to server has been dropped";
+        if(connection_pool != nullptr) {
+            release_connection();
+            return;
+        }
         if(connection_to_remote_server != NULL && connection_to_remote_server->isOpen()) {
             connection_to_remote_server->flush();
             connection_to_remote_server->disconnectFromHost();
@@ -179,6 +200,26 @@ public slots:
         }
     }
 protected:
+    /*Called by pool with socket it leased to this wrapper*/
+    virtual void on_socket_leased(QTcpSocket* socket) {
+        connection_to_remote_server = socket;
+        connect(connection_to_remote_server, SIGNAL(disconnected()), this, SLOT(disconnected()));
+        /*Failed connect never emits disconnected, pool drops such socket*/
+        connect(connection_to_remote_server, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(disconnected()));
+        if(connection_to_remote_server->state() == QAbstractSocket::ConnectedState)
+            connected();
+        else
+            connect(connection_to_remote_server, SIGNAL(connected()), this, SLOT(connected()));
+    }
+    /*Pooled socket is not closed, only this wrapper's lease and signal connections are dropped,
+     * wrapper done with its exchange calls it so waiting wrappers get the socket*/
+    void release_connection() {
+        connection_pool->cancel_wait(this);
+        if(connection_to_remote_server == nullptr) return;
+        connection_to_remote_server->disconnect(this);
+        connection_pool->release(connection_to_remote_server);
+        connection_to_remote_server = nullptr;
+    }
     virtual void compose_msg(const QString& msg, QByteArray& parcel) = 0;
     virtual void compose_msg(const QMap<QString, QString>& msgs, QByteArray& parcel) = 0;
     virtual bool parse_message_from_server(const ControlMsgType msg_type) = 0;
@@ -195,6 +236,7 @@ private:
     QList<Message> last_msg_list;
 
     QTcpSocket* connection_to_remote_server = nullptr;
+    ConnectionPool* connection_pool = nullptr;
     QMap<QString, QTcpSocket> localnet_nodes;
 };
 
@@ -220,73 +262,8 @@ private:
     int count;
 };
 
-struct Locker {
-    Locker() {
-        writer_count = reader_count = 0;
-        pthread_spin_init(&spinlock, 0);
-    }
-    ~Locker() {
-        pthread_spin_destroy(&spinlock);
-    }
-    bool add_writer() {
-        pthread_spin_lock(&spinlock);
-        if(writer_count == 0 && reader_count == 0) {
-            writer_count = 1;
-            std::cout << "Lock writer counter: " << writer_count << std::endl;
-            pthread_spin_unlock(&spinlock);
-            return true;
-        }
-        return false;
-    }
-    unsigned int add_reader() {
-        int reader_count_t = -1;
-        pthread_spin_lock(&spinlock);
-        if(writer_count == 0) {
-            ++reader_count;
-            reader_count_t = reader_count;
-        }
-        pthread_spin_unlock(&spinlock);
-        return reader_count_t;
-    }
-    bool release_writer() {
-        pthread_spin_lock(&spinlock);
-        if(writer_count == 1) {
-            writer_count = 0;
-            std::cout << "Release writer counter: " << writer_count << std::endl;
-            pthread_spin_unlock(&spinlock);
-            return true;
-        }
-        return false;
-    }
-    int release_reader() {
-        int reader_count_t = -1;
-        pthread_spin_lock(&spinlock);
-        if(reader_count > 0) {
-            --reader_count;
-            reader_count_t = reader_count;
-        }
-        pthread_spin_unlock(&spinlock);
-        return reader_count_t;
-    }
-    bool is_writer() {
-        int writer_count_t = 0;
-        pthread_spin_lock(&spinlock);
-        writer_count_t = writer_count;
-        pthread_spin_unlock(&spinlock);
-        return (writer_count_t == 1) ? true : false;
-    }
-    int count_read() {
-        int reader_count_t = 0;
-        pthread_spin_lock(&spinlock);
-        reader_count_t = reader_count;
-        pthread_spin_unlock(&spinlock);
-        return reader_count_t;
-    }
-private:
-    unsigned int writer_count;
-    unsigned int reader_count;
-    pthread_spinlock_t spinlock;
-};
+/*Kept for existing users, lock is futex based reader/writer lock now*/
+typedef RWLock Locker;
 
 template<typename T>
 class SharedPointer {
@@ -436,7 +413,7 @@ public:
                 if(safe_release_reader() == -1) return NULL;
             }
         }
-        if(locker->add_writer()) {
+        if(locker->add_writer(LOCK_WAIT_FOREVER)) {
             if(SharedPointer<T>::reset(new_data_ptr)) {
                 locker->release_writer();
                 return true;
@@ -458,7 +435,7 @@ public:
                 if(safe_release_reader() == -1) return NULL;
             }
         }
-        if(locker->add_writer()) {
+        if(locker->add_writer(LOCK_WAIT_FOREVER)) {
             if(SharedPointer<T>::reset(size)) {
                 locker->release_writer();
                 return true;
@@ -467,10 +444,11 @@ public:
         }
         return false;
     }
-    Rcount* get_locker_ptr() {
+    Locker* get_locker_ptr() {
         return locker;
     }
-    T* safe_read_data_ptr() {
+    /*Returns NULL only when lock was not taken within timeout_ms*/
+    T* safe_read_data_ptr(const int timeout_ms = LOCK_WAIT_FOREVER) {
         if(state != holder) {
             if(state == reader) {
                 return this->get_ptr();
@@ -479,16 +457,11 @@ public:
                 if(!safe_release_writer()) return NULL;
             }
         }
-        int read_count = 0;
-        int counter = 0;
-        while(read_count == 0 && counter < 10) {
-            ++counter;
-            read_count = locker->add_reader();
-            usleep(10*counter);
-        }
-        return read_count == 0 ? this->get_ptr() : NULL;
+        if(!locker->add_reader(timeout_ms)) return NULL;
+        state = reader;
+        return this->get_ptr();
     }
-    T* safe_write_data_ptr() {
+    T* safe_write_data_ptr(const int timeout_ms = LOCK_WAIT_FOREVER) {
         if(state != holder) {
             if(state == writer) {
                 return this->get_ptr();
@@ -497,22 +470,20 @@ public:
                 if(safe_release_reader() == -1) return NULL;
             }
         }
-        int counter = 0;
-        bool flag = false;
-        while(!(flag = locker->add_writer()) && counter < 10) {
-            ++counter;
-            usleep(10*counter);
-        }
-        if(flag) {
-            state = writer;
-            return this->get_ptr();
-        }
-        else
-            return NULL;
+        if(!locker->add_writer(timeout_ms)) return NULL;
+        state = writer;
+        return this->get_ptr();
+    }
+    /*Seqlock read of small trivially copyable item, does not take the lock unless writers keep interfering*/
+    bool read_snapshot(T& copy, size_t index = 0) {
+        T* data = this->get_ptr();
+        if(data == NULL || index >= this->get_data_size()) return false;
+        locker->read_snapshot(data + index, copy);
+        return true;
     }
     int safe_release_reader() {
-        int reader_count = -1;
-        if(reader_count = locker->release_reader() != -1) {
+        int reader_count = locker->release_reader();
+        if(reader_count != -1) {
             state = holder;
         }
         return reader_count;
@@ -21,6 +21,14 @@ SOFTWARE.
 #pragma once
 #include <QtNetwork>
 
+#include "framing.h"
+#include "lzcodec.h"
+#include "metrics.h"
+#include "ratelimiter.h"
+#include "readbuffer.h"
+#include "sendqueue.h"
+#include "tlssessioncache.h"
+
 class IStreamParser {
 public:
     virtual ~IStreamParser() {}
@@ -32,31 +40,95 @@ public:
     virtual bool isValidMsg() = 0;
 };
 
+/*Parser working on bytes borrowed from connection read buffer.
+ * parse returns count of consumed bytes (-1 on error), unconsumed bytes stay in read buffer
+ * and are offered again together with next portion of data. Connection resets parser right after msg_received,
+ * so parsed message has to be taken by directly connected receivers*/
+class IBufferParser {
+public:
+    virtual ~IBufferParser() {}
+
+    virtual void reset() = 0;
+    virtual qint64 parse(const char* data, const qint64 size) = 0;
+    virtual bool isEndMsg() = 0;
+    virtual bool isValidMsg() = 0;
+};
+
+/*Adapter feeding complete lines of read buffer to line oriented IStreamParser without copying them*/
+class LineBufferParser : public IBufferParser {
+public:
+    LineBufferParser(IStreamParser* parser) : parser_ptr(parser) {}
+    virtual ~LineBufferParser() {}
+
+    virtual void reset() {
+        parser_ptr->reset();
+    }
+    virtual qint64 parse(const char* data, const qint64 size) {
+        qint64 consumed = 0;
+        while(consumed < size && !parser_ptr->isEndMsg()) {
+            const char* line_end = static_cast<const char*>(memchr(data + consumed, '\n', size - consumed));
+            if(line_end == NULL) break;
+            qint64 line_size = line_end - (data + consumed) + 1;
+            QByteArray line = QByteArray::fromRawData(data + consumed, line_size);
+            parser_ptr->parse(line);
+            consumed += line_size;
+        }
+        return consumed;
+    }
+    virtual bool isEndMsg() {
+        return parser_ptr->isEndMsg();
+    }
+    virtual bool isValidMsg() {
+        return parser_ptr->isValidMsg();
+    }
+private:
+    QSharedPointer<IStreamParser> parser_ptr;
+};
+
 class TCPConnection : public QObject {
     Q_OBJECT
 public:
-    TCPConnection(QTcpSocket* socket, QObject* parent = NULL) : QObject(parent) {
-        socket_ptr.reset(socket);
+    enum FramingMode {
+        LineFraming = 0,
+        LengthPrefixedFraming
+    };
+    TCPConnection(QTcpSocket* socket, QObject* parent = NULL) : QObject(parent), conn_id(0), framing_mode(LineFraming), coalescing(true), flush_scheduled(false),
+                                                                        ever_connected(false), ready_read_ns(0), msg_start_ns(-1), msg_parse_ns(0),
+                                                                        compression_offered(false), handshake_sent(false), peer_capabilities(0),
+                                                                        msg_admitted(false), read_deferred(false), saved_read_buffer_size(0) {
+        socket_ptr = QSharedPointer<QTcpSocket>(socket, &QObject::deleteLater);
         setup_socket();
+        last_activity.start();
+        metrics.reset(new ConnectionMetrics());
     }
-    TCPConnection(IStreamParser* parser = NULL, QObject* parent = NULL) : QObject(parent) {
-        socket_ptr.reset(new QTcpSocket(this));
+    TCPConnection(IStreamParser* parser = NULL, QObject* parent = NULL) : QObject(parent), conn_id(0), framing_mode(LineFraming), coalescing(true), flush_scheduled(false),
+                                                                        ever_connected(false), ready_read_ns(0), msg_start_ns(-1), msg_parse_ns(0),
+                                                                        compression_offered(false), handshake_sent(false), peer_capabilities(0),
+                                                                        msg_admitted(false), read_deferred(false), saved_read_buffer_size(0) {
+        socket_ptr = QSharedPointer<QTcpSocket>(new QTcpSocket(), &QObject::deleteLater);
         setup_socket();
         parser_ptr.reset(parser);
+        last_activity.start();
+        metrics.reset(new ConnectionMetrics());
     }
     virtual ~TCPConnection() {
         close();
     }
 
     virtual bool close() {
-        if(!socket_ptr.isNull() && socket_ptr->isOpen()) {
-            socket_ptr->close();
-        }
-        socket_ptr->deleteLater();
+        if(socket_ptr.isNull()) return false;
+        flush();
+        if(socket_ptr->isOpen()) socket_ptr->close();
+        return true;
     }
     virtual void setup_parser(IStreamParser* parser) {
         parser_ptr.reset(parser);
     }
+    /*When buffer parser is set it takes precedence over IStreamParser*/
+    virtual void setup_buffer_parser(IBufferParser* parser) {
+        buffer_parser_ptr.reset(parser);
+        read_buffer.reset();
+    }
     virtual bool setup_socket() {
         if(socket_ptr.isNull()) {
             qDebug() << "Impossible to initialize socket";
@@ -64,20 +136,147 @@ public:
         }
         connect(socket_ptr.data(), SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(onSocketError(QAbstractSocket::SocketError)));
         connect(socket_ptr.data(), SIGNAL(readyRead()), this, SLOT(onReadyRead()));
-        connect(socket_ptr.data(), SIGNAL(bytesWritten(qint64)), this, SLOT(onBytesWritten(qint64 bytes)));
+        connect(socket_ptr.data(), SIGNAL(bytesWritten(qint64)), this, SLOT(onBytesWritten(qint64)));
         connect(socket_ptr.data(), SIGNAL(connected()), this, SLOT(onConnected()));
         connect(socket_ptr.data(), SIGNAL(disconnected()), this, SLOT(onDisconnected()));
         return true;
     }
+    void set_conn_id(const quint64 conn_id_) {
+        conn_id = conn_id_;
+    }
+    quint64 get_conn_id() const {
+        return conn_id;
+    }
+    void set_framing_mode(const FramingMode mode) {
+        framing_mode = mode;
+        /*Compression may have been offered before framing was switched on*/
+        send_handshake();
+    }
+    /*Offer payload compression in handshake frame, frames are compressed only after peer offered it too.
+     * Works in length prefixed mode, payloads shorter than threshold are never compressed*/
+    void set_compression(const bool enabled, const int threshold = DEFAULT_COMPRESS_THRESHOLD) {
+        compression_offered = enabled;
+        compressor.set_threshold(threshold);
+        send_handshake();
+    }
+    bool is_compression_active() const {
+        return compression_offered && (peer_capabilities & FrameHeader::CompressionCapability);
+    }
+    const AdaptiveCompressor& get_compressor() const {
+        return compressor;
+    }
+    FramingMode get_framing_mode() const {
+        return framing_mode;
+    }
+    /*When coalescing is on messages posted during one event loop iteration are written together*/
+    void set_coalescing(const bool coalescing_) {
+        coalescing = coalescing_;
+    }
+    void set_write_watermarks(const qint64 high_mark, const qint64 low_mark) {
+        write_watermark.set_marks(high_mark, low_mark);
+        update_watermark();
+    }
+    bool is_write_paused() const {
+        return write_watermark.is_paused();
+    }
+    /*Bytes posted to connection and not yet written to network*/
+    qint64 get_queued_bytes() const {
+        return send_queue.get_unsent_bytes();
+    }
+    /*Total time in milliseconds spent above high watermark*/
+    qint64 get_time_over_watermark() const {
+        return write_watermark.get_time_over_mark();
+    }
+    QTcpSocket* get_socket() const {
+        return socket_ptr.data();
+    }
+    /*Messages of peer over limit are not parsed: framed, line and buffered input is charged per message
+     * and stays unread until bucket refills, so kernel buffer pushes back on peer*/
+    void set_msg_rate_limiter(QSharedPointer<RateLimiter> limiter) {
+        msg_limiter = limiter;
+        if(!socket_ptr.isNull()) limited_peer = socket_ptr->peerAddress();
+    }
+    /*Counters may be read from any thread while connection is working*/
+    QSharedPointer<ConnectionMetrics> get_metrics() const {
+        return metrics;
+    }
+    /*Milliseconds since last read or completed write*/
+    qint64 get_idle_time() const {
+        return last_activity.elapsed();
+    }
+    quint64 get_write_pause_count() const {
+        return write_watermark.get_pause_count();
+    }
+    virtual bool send_Msg(QByteArray& msg) {
+        return post_msg(msg) != 0;
+    }
+    /*Send payload as single frame, frame header is written in front of payload*/
+    virtual bool send_frame(const QByteArray& payload, const quint16 frame_type = 0, const quint16 frame_flags = 0) {
+        return post_frame(payload, frame_type, frame_flags) != 0;
+    }
+    /*Queue message for sending, returned id is reported by msg_completed when message is written, 0 on failure*/
+    quint64 post_msg(const QByteArray& msg) {
+        if(socket_ptr.isNull() || !socket_ptr->isOpen()) return 0;
+        quint64 msg_id = send_queue.enqueue(msg);
+        metrics->add_msg_out(msg.size());
+        schedule_flush();
+        update_watermark();
+        /*Nothing will be written for it, completion is reported after caller got the id*/
+        if(send_queue.has_completed()) QMetaObject::invokeMethod(this, "onEmptyMsgQueued", Qt::QueuedConnection);
+        return msg_id;
+    }
+    quint64 post_frame(const QByteArray& payload, const quint16 frame_type = 0, const quint16 frame_flags = 0) {
+        if(socket_ptr.isNull() || !socket_ptr->isOpen() || payload.size() > MAX_FRAME_SIZE) return 0;
+        QByteArray chunks[2];
+        quint16 flags = frame_flags;
+        if(frame_type != FRAME_TYPE_HANDSHAKE && is_compression_active() && compressor.compress(payload, chunks[1])) {
+            flags |= FrameHeader::CompressedFlag;
+        }
+        else {
+            chunks[1] = payload;
+        }
+        chunks[0].resize(FRAME_HEADER_SIZE);
+        FrameHeader(chunks[1].size(), frame_type, flags).write_to(chunks[0].data());
+        quint64 msg_id = send_queue.enqueue(chunks, 2);
+        metrics->add_msg_out(FRAME_HEADER_SIZE + chunks[1].size());
+        schedule_flush();
+        update_watermark();
+        return msg_id;
+    }
 signals:
+    /*All queued messages are written*/
     void msg_sent(void);
+    void msg_completed(quint64 msg_id);
+    /*Backpressure notifications for producers, emitted on crossing high and low watermarks*/
+    void write_paused(void);
+    void write_resumed(void);
     void msg_received(void);
+    void frame_received(quint16 frame_type, quint16 frame_flags, const QByteArray& payload);
+    void connection_closed(void);
 public slots:
     void connectToHost(const QString& host_address, const qint16 port) {
         socket_ptr->connectToHost(host_address, port);
     }
-private slots:
+    void flush() {
+        flush_scheduled = false;
+        if(socket_ptr.isNull() || !socket_ptr->isOpen() || !send_queue.hasPending()) return;
+        /*Encrypted data must pass through QSslSocket, so descriptor is used directly only for plain connections*/
+        bool allow_vectored = socket_ptr->state() == QAbstractSocket::ConnectedState && qobject_cast<QSslSocket*>(socket_ptr.data()) == NULL;
+        qint64 direct_written = send_queue.flush(socket_ptr.data(), allow_vectored);
+        if(direct_written < 0) {
+            qDebug() << "Write to socket failed: " << socket_ptr->errorString();
+            socket_ptr->abort();
+            return;
+        }
+        if(direct_written > 0) complete_written(direct_written);
+    }
+protected slots:
     void onConnected() {
+        if(ever_connected) metrics->add_reconnect();
+        ever_connected = true;
+        handshake_sent = false;
+        peer_capabilities = 0;
+        send_handshake();
         time_conn_est = QDateTime::currentDateTime();
         qInfo() << "Connection was established at: " << time_conn_est.toString(QString("MMM d, yyyy @ h:m:s.zzz ap"));
     }
@@ -85,6 +284,7 @@ private slots:
         time_conn_est = QDateTime::currentDateTime();
         qInfo() << "Connection was closed at: " << time_conn_est.toString(QString("MMM d, yyyy @ h:m:s.zzz ap"));
         close();
+        emit connection_closed();
     }
     void onSocketError(QAbstractSocket::SocketError) {
         if(socket_ptr->state() == QAbstractSocket::ConnectedState) {
@@ -93,137 +293,342 @@ private slots:
         qDebug() << "Socket error occured: " << socket_ptr->errorString();
     }
     void onBytesWritten(qint64 bytes) {
-        sent_size += bytes;
-        if(sent_size == msg_size) emit msg_sent();
+        last_activity.restart();
+        complete_written(bytes);
+    }
+    void onEmptyMsgQueued() {
+        complete_written(0);
     }
     void onReadyRead() {
         quint64 bas = socket_ptr->bytesAvailable();
         if(bas == 0) return;
+        last_activity.restart();
+        ready_read_ns = metrics_now_ns();
+        if(msg_start_ns < 0) msg_start_ns = ready_read_ns;
+        if(!read_deferred) read_input();
+    }
+    void onReadDeferred() {
+        read_deferred = false;
+        socket_ptr->setReadBufferSize(saved_read_buffer_size);
+        read_input();
+    }
+protected:
+    void read_input() {
+        if(framing_mode == LengthPrefixedFraming)
+            read_frames();
+        else if(!buffer_parser_ptr.isNull())
+            read_buffered();
+        else
+            read_lines();
+    }
+    /*Token is taken once per message, before its first byte is parsed*/
+    bool admit_msg() {
+        if(msg_admitted || msg_limiter.isNull() || msg_limiter->allow(limited_peer)) {
+            msg_admitted = true;
+            return true;
+        }
+        return false;
+    }
+    void defer_read() {
+        if(read_deferred) return;
+        read_deferred = true;
+        /*Socket keeps at most this much while reading is paused, size set by user is restored afterwards*/
+        saved_read_buffer_size = socket_ptr->readBufferSize();
+        socket_ptr->setReadBufferSize(saved_read_buffer_size > 0 ? qMin<qint64>(saved_read_buffer_size, DEFAULT_READ_BUFFER_SIZE) : DEFAULT_READ_BUFFER_SIZE);
+        QTimer::singleShot(msg_limiter->get_retry_delay(), this, SLOT(onReadDeferred()));
+    }
+    void schedule_flush() {
+        if(!coalescing || send_queue.get_pending_bytes() >= DEFAULT_COALESCE_LIMIT) {
+            flush();
+        }
+        else if(!flush_scheduled) {
+            flush_scheduled = true;
+            QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+        }
+    }
+    void complete_written(const qint64 bytes) {
+        QList<quint64> completed;
+        send_queue.on_bytes_written(bytes, completed);
+        foreach(quint64 msg_id, completed) {
+            emit msg_completed(msg_id);
+        }
+        if(!completed.isEmpty() && send_queue.get_unsent_bytes() == 0) emit msg_sent();
+        update_watermark();
+    }
+    void update_watermark() {
+        int change = write_watermark.update(send_queue.get_unsent_bytes());
+        if(change > 0)
+            emit write_paused();
+        else if(change < 0)
+            emit write_resumed();
+    }
+    void read_lines() {
+        if(parser_ptr.isNull()) return;
+        if(socket_ptr->canReadLine() && !parser_ptr->isEndMsg() && !admit_msg()) {
+            defer_read();
+            return;
+        }
         QString lastLine;
         while(socket_ptr->canReadLine() && !parser_ptr->isEndMsg()) {
-            lastLine = socket_ptr->readLine();
+            QByteArray line = socket_ptr->readLine();
+            metrics->add_bytes_in(line.size());
+            lastLine = line;
+            qint64 parse_start = metrics_now_ns();
             parser_ptr->parse(lastLine);
+            msg_parse_ns += metrics_now_ns() - parse_start;
         }
         if(!parser_ptr->isValidMsg()) {
             parser_ptr->reset();
+            on_parse_error();
             return;
         }
-        if(parser_ptr->isEndMsg()) emit msg_received();
+        if(parser_ptr->isEndMsg()) {
+            on_msg_parsed();
+            emit msg_received();
+        }
     }
-private:
+    /*Parser consumes bytes directly from read buffer, partial message stays there until more data arrives*/
+    void read_buffered() {
+        metrics->add_bytes_in(qMax<qint64>(0, read_buffer.fill_from(socket_ptr.data())));
+        while(!read_buffer.isEmpty()) {
+            if(!admit_msg()) {
+                defer_read();
+                return;
+            }
+            qint64 parse_start = metrics_now_ns();
+            qint64 consumed = buffer_parser_ptr->parse(read_buffer.data(), read_buffer.size());
+            msg_parse_ns += metrics_now_ns() - parse_start;
+            if(consumed < 0 || !buffer_parser_ptr->isValidMsg()) {
+                buffer_parser_ptr->reset();
+                read_buffer.reset();
+                on_parse_error();
+                return;
+            }
+            read_buffer.consume(consumed);
+            if(buffer_parser_ptr->isEndMsg()) {
+                on_msg_parsed();
+                emit msg_received();
+                buffer_parser_ptr->reset();
+            }
+            else if(consumed == 0) {
+                break;
+            }
+        }
+    }
+    /*Frames are sliced out of read buffer as soon as they are complete, incomplete tail stays in read buffer*/
+    void read_frames() {
+        metrics->add_bytes_in(qMax<qint64>(0, read_buffer.fill_from(socket_ptr.data())));
+        FrameHeader header;
+        while(read_buffer.size() >= FRAME_HEADER_SIZE) {
+            if(!header.read_from(read_buffer.data())) {
+                qDebug() << "Malformed frame header received from: " << socket_ptr->peerAddress().toString();
+                read_buffer.reset();
+                on_parse_error();
+                socket_ptr->abort();
+                return;
+            }
+            if(read_buffer.size() < FRAME_HEADER_SIZE + header.length) break;
+            /*Token is charged per logical message: by plain frame or by last chunk of stream message.
+             * Over limit frame is kept and reading pauses, dropping it would corrupt multiplexed streams*/
+            bool is_partial_chunk = (header.flags & FrameHeader::StreamChunkFlag) && !(header.flags & FrameHeader::StreamEndFlag);
+            if(header.type != FRAME_TYPE_HANDSHAKE && !is_partial_chunk && !admit_msg()) {
+                defer_read();
+                return;
+            }
+            dispatch_frame(header, read_buffer.data() + FRAME_HEADER_SIZE);
+            read_buffer.consume(FRAME_HEADER_SIZE + header.length);
+        }
+    }
+    /*Payload pointer is valid only until frame is consumed, frame_received subscribers get their own copy*/
+    void dispatch_frame(const FrameHeader& header, const char* payload) {
+        if(header.type == FRAME_TYPE_HANDSHAKE) {
+            on_handshake(payload, header.length);
+            return;
+        }
+        if(header.flags & FrameHeader::CompressedFlag) {
+            QByteArray inflated;
+            if(!LZCodec::decompress(payload, header.length, inflated)) {
+                qDebug() << "Malformed compressed frame received from: " << socket_ptr->peerAddress().toString();
+                on_parse_error();
+                return;
+            }
+            dispatch_frame(FrameHeader(inflated.size(), header.type, header.flags & ~FrameHeader::CompressedFlag), inflated.constData());
+            return;
+        }
+        if(receivers(SIGNAL(frame_received(quint16, quint16, QByteArray))) > 0) {
+            emit frame_received(header.type, header.flags, QByteArray(payload, header.length));
+        }
+        qint64 parse_start = metrics_now_ns();
+        if(!buffer_parser_ptr.isNull()) {
+            qint64 consumed = buffer_parser_ptr->parse(payload, header.length);
+            msg_parse_ns += metrics_now_ns() - parse_start;
+            if(consumed < 0 || !buffer_parser_ptr->isValidMsg()) {
+                buffer_parser_ptr->reset();
+                on_parse_error();
+                return;
+            }
+            if(buffer_parser_ptr->isEndMsg()) {
+                on_msg_parsed();
+                emit msg_received();
+                buffer_parser_ptr->reset();
+            }
+            return;
+        }
+        if(parser_ptr.isNull()) {
+            on_msg_parsed();
+            return;
+        }
+        QByteArray payload_ref = QByteArray::fromRawData(payload, header.length);
+        parser_ptr->parse(payload_ref);
+        msg_parse_ns += metrics_now_ns() - parse_start;
+        if(!parser_ptr->isValidMsg()) {
+            parser_ptr->reset();
+            on_parse_error();
+            return;
+        }
+        if(parser_ptr->isEndMsg()) {
+            on_msg_parsed();
+            emit msg_received();
+        }
+    }
+    /*Message clock starts with readyRead delivering its first bytes,
+     * following message already waiting in buffers is timed from the same readyRead*/
+    void on_msg_parsed() {
+        msg_admitted = false;
+        qint64 now = metrics_now_ns();
+        metrics->add_msg_in(msg_parse_ns, now - msg_start_ns);
+        msg_parse_ns = 0;
+        msg_start_ns = (read_buffer.isEmpty() && socket_ptr->bytesAvailable() == 0) ? -1 : ready_read_ns;
+    }
+    /*Each side sends its handshake once per connection when it is connected and has something to offer*/
+    void send_handshake() {
+        if(handshake_sent || !compression_offered || framing_mode != LengthPrefixedFraming) return;
+        if(socket_ptr.isNull() || socket_ptr->state() != QAbstractSocket::ConnectedState) return;
+        QByteArray payload(4, 0);
+        qToBigEndian<quint16>(HANDSHAKE_VERSION, reinterpret_cast<uchar*>(payload.data()));
+        qToBigEndian<quint16>(FrameHeader::CompressionCapability, reinterpret_cast<uchar*>(payload.data() + 2));
+        handshake_sent = post_frame(payload, FRAME_TYPE_HANDSHAKE) != 0;
+    }
+    void on_handshake(const char* payload, const quint32 length) {
+        if(length < 4) return;
+        peer_capabilities = qFromBigEndian<quint16>(reinterpret_cast<const uchar*>(payload + 2));
+    }
+    void on_parse_error() {
+        msg_admitted = false;
+        metrics->add_parse_error();
+        msg_parse_ns = 0;
+        msg_start_ns = -1;
+    }
+
     QDateTime time_conn_est;
-    size_t msg_size, sent_size;
+    QElapsedTimer last_activity;
+    quint64 conn_id;
+    FramingMode framing_mode;
+    bool coalescing;
+    bool flush_scheduled;
+    bool ever_connected;
+    qint64 ready_read_ns;
+    qint64 msg_start_ns;
+    qint64 msg_parse_ns;
+    QSharedPointer<ConnectionMetrics> metrics;
+    bool compression_offered;
+    bool handshake_sent;
+    quint16 peer_capabilities;
+    AdaptiveCompressor compressor;
+    bool msg_admitted;
+    bool read_deferred;
+    qint64 saved_read_buffer_size;
+    QHostAddress limited_peer;
+    QSharedPointer<RateLimiter> msg_limiter;
+    OutboundQueue send_queue;
+    WriteWatermark write_watermark;
     QString last_error;
     QSharedPointer<QTcpSocket> socket_ptr;
     QSharedPointer<IStreamParser> parser_ptr;
+    QSharedPointer<IBufferParser> buffer_parser_ptr;
+    ReadBuffer read_buffer;
 };
 
-class SSLConnection : public QObject {
+/*Encrypted connection, reading, framing and sending are inherited from TCPConnection*/
+class SSLConnection : public TCPConnection {
     Q_OBJECT
 public:
-    SSLConnection(IStreamParser* parser = NULL, QObject* parent = NULL) : QObject(parent) {
-        socket_ptr.reset(new QSslSocket(this));
-        setup_socket();
+    SSLConnection(IStreamParser* parser = NULL, QObject* parent = NULL) : TCPConnection(new QSslSocket(), parent) {
+        setup_ssl_socket();
         parser_ptr.reset(parser);
     }
-    virtual ~SSLConnection() {
-        close();
-    }
+    virtual ~SSLConnection() {}
 
-    virtual bool close() {
-        if(!socket_ptr.isNull() && socket_ptr->isOpen()) {
-            socket_ptr->close();
-        }
-        socket_ptr->deleteLater();
-    }
-    virtual void setup_parser(IStreamParser* parser) {
-        parser_ptr.reset(parser);
-    }
-    virtual bool setup_socket() {
-        if(socket_ptr.isNull()) {
-            qDebug() << "Impossible to initialize socket";
+    virtual bool setup_ssl_socket() {
+        QSslSocket* ssl_socket = get_ssl_socket();
+        if(ssl_socket == NULL) {
+            qDebug() << "Impossible to initialize ssl socket";
             return false;
         }
-        connect(socket_ptr.data(), SIGNAL(encrypted()), this, SLOT(onEncrypted()));
-        connect(socket_ptr.data(), SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(onSslErrors(QList<QSslError>)));
-        connect(socket_ptr.data(), SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(onSocketError(QAbstractSocket::SocketError)));
-        connect(socket_ptr.data(), SIGNAL(readyRead()), this, SLOT(onReadyRead()));
-        connect(socket_ptr.data(), SIGNAL(bytesWritten(qint64)), this, SLOT(onBytesWritten()));
-        connect(socket_ptr.data(), SIGNAL(connected()), this, SLOT(onConnected()));
-        connect(socket_ptr.data(), SIGNAL(disconnected()), this, SLOT(onDisconnected()));
+        connect(ssl_socket, SIGNAL(encrypted()), this, SLOT(onEncrypted()));
+        connect(ssl_socket, SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(onSslErrors(QList<QSslError>)));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+        connect(ssl_socket, SIGNAL(newSessionTicketReceived()), this, SLOT(onNewSessionTicket()));
+#endif
         return true;
     }
-    virtual bool send_Msg(QByteArray& msg) {
-        msg_size = msg.size();
-        try {
-            socket_ptr->write(msg);
-        }
-        catch(const std::exception& ex) {
-            qDebug() << "Exception occured when message sending: " << ex.what();
-        }
+    /*Session tickets received from peers are kept in cache and offered on next connect to the same peer*/
+    void set_session_cache(QSharedPointer<TlsSessionCache> session_cache_) {
+        session_cache = session_cache_;
+    }
+    QSslSocket* get_ssl_socket() const {
+        return qobject_cast<QSslSocket*>(socket_ptr.data());
     }
-signals:
-    void msg_sent(void);
-    void msg_received(void);
 public slots:
     void secureConnect(const QString& host_address, const qint16 port) {
-        socket_ptr->connectToHostEncrypted(host_address, port);
+        QSslSocket* ssl_socket = get_ssl_socket();
+        offered_ticket.clear();
+        if(!session_cache.isNull()) {
+            peer_key = TlsSessionCache::peer_key(host_address, port);
+            QSslConfiguration config = ssl_socket->sslConfiguration();
+            TlsSessionCache::configure_client(config);
+            if(session_cache->get_session(peer_key, offered_ticket)) config.setSessionTicket(offered_ticket);
+            ssl_socket->setSslConfiguration(config);
+        }
+        ssl_socket->connectToHostEncrypted(host_address, port);
     }
 private slots:
-    void onConnected() {
-        time_conn_est = QDateTime::currentDateTime();
-        qInfo() << "Connection was established at: " << time_conn_est.toString(QString("MMM d, yyyy @ h:m:s.zzz ap"));
-    }
-    void onDisconnected() {
-        time_conn_est = QDateTime::currentDateTime();
-        qInfo() << "Connection was closed at: " << time_conn_est.toString(QString("MMM d, yyyy @ h:m:s.zzz ap"));
-        close();
-    }
     void onEncrypted() {
-        const QSslCipher cipher = socket_ptr->sessionCipher();
+        const QSslCipher cipher = get_ssl_socket()->sessionCipher();
         qInfo() << "Connection encrypted: " << QString("%1, %2").arg(cipher.authenticationMethod()).arg(cipher.name());
+        if(session_cache.isNull()) return;
+        /*Peer accepting offered session keeps its ticket, otherwise full handshake issued new session*/
+        QByteArray ticket = get_ssl_socket()->sslConfiguration().sessionTicket();
+        session_cache->register_handshake(!offered_ticket.isEmpty() && ticket == offered_ticket);
+        store_session_ticket();
+    }
+    void onNewSessionTicket() {
+        store_session_ticket();
     }
     void onSslErrors(const QList<QSslError>& errors) {
         foreach (QSslError error, errors) {
             qDebug() << "SSL error occured: " << error.errorString();
         }
-        socket_ptr->ignoreSslErrors();
-        if(socket_ptr->state() != QAbstractSocket::ConnectedState) {
-            qInfo() << "Connection was broken: " << socket_ptr->errorString();
+        QSslSocket* ssl_socket = get_ssl_socket();
+        if(!session_cache.isNull() && !offered_ticket.isEmpty()) session_cache->remove_session(peer_key);
+        ssl_socket->ignoreSslErrors();
+        if(ssl_socket->state() != QAbstractSocket::ConnectedState) {
+            qInfo() << "Connection was broken: " << ssl_socket->errorString();
         }
         else {
-            socket_ptr->close();
-        }
-    }
-    void onSocketError(QAbstractSocket::SocketError) {
-        if(socket_ptr->state() == QAbstractSocket::ConnectedState) {
-            socket_ptr->close();
+            ssl_socket->close();
         }
-        qDebug() << "Socket error occured: " << socket_ptr->errorString();
-    }
-    void onBytesWritten(qint64 bytes) {
-        sent_size += bytes;
-        if(sent_size == msg_size) emit msg_sent();
-    }
-    void onReadyRead() {
-        quint64 bas = socket_ptr->bytesAvailable();
-        if(bas == 0) return;
-        QString lastLine;
-        while(socket_ptr->canReadLine() && !parser_ptr->isEndMsg()) {
-            lastLine = socket_ptr->readLine();
-            parser_ptr->parse(lastLine);
-        }
-        if(!parser_ptr->isValidMsg()) {
-            parser_ptr->reset();
-            return;
-        }
-        if(parser_ptr->isEndMsg()) emit msg_received();
     }
 private:
-    QDateTime time_conn_est;
-    size_t msg_size, sent_size;
-    QSharedPointer<IStreamParser> parser_ptr;
-    QSharedPointer<QSslSocket> socket_ptr;
+    void store_session_ticket() {
+        if(session_cache.isNull() || peer_key.isEmpty()) return;
+        const QSslConfiguration config = get_ssl_socket()->sslConfiguration();
+        session_cache->store_session(peer_key, config.sessionTicket(), config.sessionTicketLifeTimeHint());
+    }
+
+    QString peer_key;
+    QByteArray offered_ticket;
+    QSharedPointer<TlsSessionCache> session_cache;
 };
 
 #endif // CONNECTION_H
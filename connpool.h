@@ -0,0 +1,261 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef CONNPOOL_H
+#define CONNPOOL_H
+#pragma once
+#include <QtNetwork>
+
+#ifdef Q_OS_LINUX
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+#define DEFAULT_MAX_CONN_PER_PEER 4
+#define DEFAULT_POOL_IDLE_TIMEOUT 60000
+#define DEFAULT_POOL_CHECK_INTERVAL 10000
+#define DEFAULT_KEEPALIVE_IDLE 30
+#define DEFAULT_KEEPALIVE_INTERVAL 10
+#define DEFAULT_KEEPALIVE_COUNT 3
+
+/*Receives socket leased after it waited in pool queue*/
+class IPoolWaiter {
+public:
+    virtual ~IPoolWaiter() {}
+
+    virtual void on_socket_leased(QTcpSocket* socket) = 0;
+};
+
+/*Outbound sockets keyed by host and port and reused by consecutive users. Socket is leased exclusively,
+ * since plain stream has no way to tell whose reply is being read, so released connected socket is handed
+ * to next user and new one is opened only while limit per peer is not reached. When all sockets of peer
+ * are leased users wait in queue and get socket on release in arrival order. Sockets which failed
+ * to connect or dropped are removed at once. Idle sockets are probed by TCP keep-alive
+ * and closed after idle timeout without leases. Pool and its sockets belong to one thread*/
+class ConnectionPool : public QObject {
+    Q_OBJECT
+    struct PooledSocket {
+        PooledSocket(QTcpSocket* socket_ = NULL) : socket(socket_), leases(0) {
+            last_used.start();
+        }
+        QTcpSocket* socket;
+        int leases;
+        QElapsedTimer last_used;
+    };
+    struct Waiter {
+        IPoolWaiter* waiter;
+        QString host_address;
+        quint16 port;
+    };
+public:
+    ConnectionPool(const int max_conn_per_peer_ = DEFAULT_MAX_CONN_PER_PEER, const int idle_timeout_ = DEFAULT_POOL_IDLE_TIMEOUT, QObject* parent = NULL) :
+        QObject(parent), max_conn_per_peer(max_conn_per_peer_), idle_timeout(idle_timeout_) {
+        connect(&idle_timer, SIGNAL(timeout()), this, SLOT(onIdleCheck()));
+        idle_timer.start(DEFAULT_POOL_CHECK_INTERVAL);
+    }
+    virtual ~ConnectionPool() {
+        reset();
+    }
+
+    virtual void reset() {
+        QHash<QString, QList<PooledSocket> >::iterator iter = peers.begin();
+        while(iter != peers.end()) {
+            foreach(const PooledSocket& pooled, iter.value()) {
+                pooled.socket->disconnect(this);
+                pooled.socket->abort();
+                pooled.socket->deleteLater();
+            }
+            ++iter;
+        }
+        peers.clear();
+        socket_keys.clear();
+        waiters.clear();
+    }
+    static QString peer_key(const QString& host_address, const quint16 port) {
+        return QString("%1:%2").arg(host_address).arg(port);
+    }
+    /*Returned socket stays owned by pool, every acquire has to be paired with release.
+     * NULL when all max_conn_per_peer sockets of peer are leased, then waiter if given is queued
+     * and gets socket through on_socket_leased, waiter which goes away has to call cancel_wait*/
+    QTcpSocket* acquire(const QString& host_address, const quint16 port, IPoolWaiter* waiter = NULL) {
+        QTcpSocket* socket = try_acquire(host_address, port);
+        if(socket == NULL && waiter != NULL) {
+            Waiter entry;
+            entry.waiter = waiter;
+            entry.host_address = host_address;
+            entry.port = port;
+            waiters[peer_key(host_address, port)].enqueue(entry);
+        }
+        return socket;
+    }
+    void cancel_wait(IPoolWaiter* waiter) {
+        QHash<QString, QQueue<Waiter> >::iterator iter = waiters.begin();
+        while(iter != waiters.end()) {
+            QMutableListIterator<Waiter> waiter_iter(iter.value());
+            while(waiter_iter.hasNext()) {
+                if(waiter_iter.next().waiter == waiter) waiter_iter.remove();
+            }
+            if(iter.value().isEmpty())
+                iter = waiters.erase(iter);
+            else
+                ++iter;
+        }
+    }
+    int get_waiter_count(const QString& host_address, const quint16 port) const {
+        return waiters.value(peer_key(host_address, port)).size();
+    }
+    void release(QTcpSocket* socket) {
+        PooledSocket* pooled = find(socket);
+        if(pooled == NULL || pooled->leases == 0) return;
+        --pooled->leases;
+        pooled->last_used.restart();
+        serve_waiters(socket_keys.value(socket));
+    }
+    int get_conn_count(const QString& host_address, const quint16 port) const {
+        return peers.value(peer_key(host_address, port)).size();
+    }
+    int get_total_conn_count() const {
+        int count = 0;
+        foreach(const QList<PooledSocket>& peer_sockets, peers) {
+            count += peer_sockets.size();
+        }
+        return count;
+    }
+private slots:
+    void onSocketConnected() {
+        QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+        if(socket != NULL) setup_keepalive(socket);
+    }
+    /*Dropped sockets and sockets which failed to connect are forgotten, their users get
+     * disconnected or error signal from socket itself*/
+    void onSocketStateChanged(QAbstractSocket::SocketState state) {
+        if(state != QAbstractSocket::UnconnectedState) return;
+        QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+        if(socket == NULL) return;
+        remove(socket);
+    }
+    void onIdleCheck() {
+        QHash<QString, QList<PooledSocket> >::iterator iter = peers.begin();
+        while(iter != peers.end()) {
+            QMutableListIterator<PooledSocket> socket_iter(iter.value());
+            while(socket_iter.hasNext()) {
+                PooledSocket& pooled = socket_iter.next();
+                if(pooled.leases > 0 || pooled.last_used.elapsed() < idle_timeout) continue;
+                socket_keys.remove(pooled.socket);
+                pooled.socket->disconnect(this);
+                pooled.socket->disconnectFromHost();
+                pooled.socket->deleteLater();
+                socket_iter.remove();
+            }
+            if(iter.value().isEmpty())
+                iter = peers.erase(iter);
+            else
+                ++iter;
+        }
+    }
+private:
+    QTcpSocket* try_acquire(const QString& host_address, const quint16 port) {
+        QList<PooledSocket>& peer_sockets = peers[peer_key(host_address, port)];
+        int best_index = -1;
+        for(int i = 0; i < peer_sockets.size(); ++i) {
+            if(peer_sockets[i].leases > 0 || !is_usable(peer_sockets[i].socket)) continue;
+            /*Connected socket is preferred to one still connecting*/
+            if(best_index < 0 || peer_sockets[i].socket->state() == QAbstractSocket::ConnectedState) best_index = i;
+        }
+        if(best_index < 0) {
+            if(peer_sockets.size() >= max_conn_per_peer) return NULL;
+            QTcpSocket* socket = open_socket(host_address, port);
+            socket_keys.insert(socket, peer_key(host_address, port));
+            peer_sockets.append(PooledSocket(socket));
+            best_index = peer_sockets.size() - 1;
+        }
+        PooledSocket& pooled = peer_sockets[best_index];
+        ++pooled.leases;
+        pooled.last_used.restart();
+        return pooled.socket;
+    }
+    /*Hands sockets freed by release or removal to queued waiters, waiter served gets signals
+     * of its socket itself so callback is the last thing done for it*/
+    void serve_waiters(const QString& key) {
+        QHash<QString, QQueue<Waiter> >::iterator iter = waiters.find(key);
+        while(iter != waiters.end() && !iter.value().isEmpty()) {
+            const Waiter& head = iter.value().head();
+            QTcpSocket* socket = try_acquire(head.host_address, head.port);
+            if(socket == NULL) return;
+            IPoolWaiter* waiter = iter.value().dequeue().waiter;
+            if(iter.value().isEmpty()) waiters.erase(iter);
+            waiter->on_socket_leased(socket);
+            iter = waiters.find(key);
+        }
+    }
+    QTcpSocket* open_socket(const QString& host_address, const quint16 port) {
+        QTcpSocket* socket = new QTcpSocket(this);
+        connect(socket, SIGNAL(connected()), this, SLOT(onSocketConnected()));
+        connect(socket, SIGNAL(stateChanged(QAbstractSocket::SocketState)), this, SLOT(onSocketStateChanged(QAbstractSocket::SocketState)));
+        socket->connectToHost(host_address, port);
+        return socket;
+    }
+    static bool is_usable(QTcpSocket* socket) {
+        return socket->state() != QAbstractSocket::UnconnectedState && socket->state() != QAbstractSocket::ClosingState;
+    }
+    static void setup_keepalive(QTcpSocket* socket) {
+        socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+#ifdef Q_OS_LINUX
+        int descriptor = socket->socketDescriptor();
+        int keepalive_idle = DEFAULT_KEEPALIVE_IDLE;
+        int keepalive_interval = DEFAULT_KEEPALIVE_INTERVAL;
+        int keepalive_count = DEFAULT_KEEPALIVE_COUNT;
+        setsockopt(descriptor, IPPROTO_TCP, TCP_KEEPIDLE, &keepalive_idle, sizeof(keepalive_idle));
+        setsockopt(descriptor, IPPROTO_TCP, TCP_KEEPINTVL, &keepalive_interval, sizeof(keepalive_interval));
+        setsockopt(descriptor, IPPROTO_TCP, TCP_KEEPCNT, &keepalive_count, sizeof(keepalive_count));
+#endif
+    }
+    PooledSocket* find(QTcpSocket* socket) {
+        QHash<QString, QList<PooledSocket> >::iterator iter = peers.find(socket_keys.value(socket));
+        if(iter == peers.end()) return NULL;
+        for(int i = 0; i < iter.value().size(); ++i) {
+            if(iter.value()[i].socket == socket) return &iter.value()[i];
+        }
+        return NULL;
+    }
+    void remove(QTcpSocket* socket) {
+        const QString peer_key = socket_keys.take(socket);
+        QHash<QString, QList<PooledSocket> >::iterator iter = peers.find(peer_key);
+        if(iter == peers.end()) return;
+        for(int i = 0; i < iter.value().size(); ++i) {
+            if(iter.value()[i].socket != socket) continue;
+            iter.value().removeAt(i);
+            break;
+        }
+        if(iter.value().isEmpty()) peers.erase(iter);
+        socket->disconnect(this);
+        socket->deleteLater();
+        serve_waiters(peer_key);
+    }
+
+    int max_conn_per_peer;
+    int idle_timeout;
+    QTimer idle_timer;
+    QHash<QString, QList<PooledSocket> > peers;
+    QHash<QTcpSocket*, QString> socket_keys;
+    QHash<QString, QQueue<Waiter> > waiters;
+};
+
+#endif // CONNPOOL_H
@@ -0,0 +1,106 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef CONNREGISTRY_H
+#define CONNREGISTRY_H
+#pragma once
+#include <QtNetwork>
+
+#include <atomic>
+
+class TCPConnection;
+
+/*Address/port pair of both ends of TCP connection*/
+struct ConnectionKey {
+    ConnectionKey() : peer_port(0), local_port(0) {}
+    ConnectionKey(const QAbstractSocket* socket) : peer_address(socket->peerAddress()), peer_port(socket->peerPort()),
+                                                   local_address(socket->localAddress()), local_port(socket->localPort()) {}
+
+    bool operator == (const ConnectionKey& other) const {
+        return peer_port == other.peer_port && local_port == other.local_port &&
+               peer_address == other.peer_address && local_address == other.local_address;
+    }
+    QHostAddress peer_address;
+    quint16 peer_port;
+    QHostAddress local_address;
+    quint16 local_port;
+};
+
+inline uint qHash(const ConnectionKey& key, uint seed = 0) {
+    return qHash(key.peer_address, seed) ^ qHash(key.local_address, seed) ^ (uint(key.peer_port) << 16 | key.local_port);
+}
+
+/*Index of live connections by connection id and by address tuple, shared between server and its workers.
+ * Registry does not own connections, owner unregisters connection before deleting it*/
+class ConnectionRegistry {
+public:
+    ConnectionRegistry() : next_conn_id(1) {}
+    virtual ~ConnectionRegistry() {
+        reset();
+    }
+
+    void reset() {
+        QWriteLocker locker(&lock);
+        connections.clear();
+        conn_ids.clear();
+    }
+    quint64 register_conn(TCPConnection* conn, const ConnectionKey& key) {
+        quint64 conn_id = next_conn_id++;
+        QWriteLocker locker(&lock);
+        connections.insert(conn_id, Entry(conn, key));
+        conn_ids.insert(key, conn_id);
+        return conn_id;
+    }
+    /*Id for connection which is kept outside of registry, e.g. by epoll loop*/
+    quint64 reserve_conn_id() {
+        return next_conn_id++;
+    }
+    bool unregister_conn(const quint64 conn_id) {
+        QWriteLocker locker(&lock);
+        QHash<quint64, Entry>::iterator iter = connections.find(conn_id);
+        if(iter == connections.end()) return false;
+        conn_ids.remove(iter.value().key);
+        connections.erase(iter);
+        return true;
+    }
+    /*Returned connection belongs to thread of its owner and has to be used there*/
+    TCPConnection* find_conn(const quint64 conn_id) const {
+        QReadLocker locker(&lock);
+        return connections.value(conn_id).conn;
+    }
+    quint64 find_conn_id(const ConnectionKey& key) const {
+        QReadLocker locker(&lock);
+        return conn_ids.value(key, 0);
+    }
+    int size() const {
+        QReadLocker locker(&lock);
+        return connections.size();
+    }
+private:
+    struct Entry {
+        Entry(TCPConnection* conn_ = NULL, const ConnectionKey& key_ = ConnectionKey()) : conn(conn_), key(key_) {}
+        TCPConnection* conn;
+        ConnectionKey key;
+    };
+    std::atomic<quint64> next_conn_id;
+    mutable QReadWriteLock lock;
+    QHash<quint64, Entry> connections;
+    QHash<ConnectionKey, quint64> conn_ids;
+};
+
+#endif // CONNREGISTRY_H
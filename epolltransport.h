@@ -0,0 +1,513 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef EPOLLTRANSPORT_H
+#define EPOLLTRANSPORT_H
+#pragma once
+#include <QtNetwork>
+
+#include "connection.h"
+#include "localtransport.h"
+
+#ifdef Q_OS_LINUX
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <atomic>
+
+#define EPOLL_MAX_EVENTS 256
+
+class EpollConnection;
+class EpollLoop;
+
+/*Callbacks are called directly from loop thread without any event dispatch,
+ * handler shared by several loops has to be thread safe*/
+class IEpollHandler {
+public:
+    virtual ~IEpollHandler() {}
+
+    /*Called for accepted and for established outgoing connections, right place to setup parser*/
+    virtual void on_connected(EpollConnection*) {}
+    /*Parser of connection holds complete message, it is reset right after return*/
+    virtual void on_msg_received(EpollConnection* conn) = 0;
+    virtual void on_connection_closed(EpollConnection*) {}
+};
+
+/*Non blocking socket served by EpollLoop, counterpart of TCPConnection without QObject.
+ * Object belongs to loop thread, loop may close and delete it at any moment, so other threads must not
+ * keep pointers to it and address connection by id through EpollLoop::send_to and close_conn.
+ * Unlike TCPConnection it is not registered in ConnectionRegistry, has no metrics, message rate limit,
+ * idle eviction, compression handshake, TLS or write watermarks*/
+class EpollConnection {
+    friend class EpollLoop;
+public:
+    EpollConnection(EpollLoop* loop_, const int descriptor_, const quint64 conn_id_) : loop(loop_), descriptor(descriptor_), conn_id(conn_id_),
+                                                                                      connecting(false), local(false), want_write(false), out_offset(0), out_bytes(0) {}
+    virtual ~EpollConnection() {
+        if(descriptor >= 0) ::close(descriptor);
+    }
+
+    void setup_parser(IStreamParser* parser) {
+        buffer_parser_ptr.reset(new LineBufferParser(parser));
+    }
+    void setup_buffer_parser(IBufferParser* parser) {
+        buffer_parser_ptr.reset(parser);
+        read_buffer.reset();
+    }
+    QSharedPointer<IBufferParser> get_parser() const {
+        return buffer_parser_ptr;
+    }
+    quint64 get_conn_id() const {
+        return conn_id;
+    }
+    int get_descriptor() const {
+        return descriptor;
+    }
+    EpollLoop* get_loop() const {
+        return loop;
+    }
+    bool is_connected() const {
+        return descriptor >= 0 && !connecting;
+    }
+    bool is_local() const {
+        return local;
+    }
+    /*Rings for bulk payloads, transport does not negotiate them, so application creates tx ring,
+     * sends its name to peer in own message and attaches rx ring by name peer announced*/
+    void set_bulk_rings(QSharedPointer<ShmRing> tx_ring_, QSharedPointer<ShmRing> rx_ring_) {
+        tx_ring = tx_ring_;
+        rx_ring = rx_ring_;
+    }
+    /*Payload goes through shared memory and only short notify_msg crosses socket,
+     * without ring or when ring is full payload is sent over socket. Loop thread only*/
+    bool send_bulk(const QByteArray& payload, const QByteArray& notify_msg) {
+        if(!tx_ring.isNull() && tx_ring->push(payload)) return send_Msg(notify_msg);
+        return send_Msg(payload);
+    }
+    /*Take next bulk payload after notify message was received*/
+    bool receive_bulk(QByteArray& payload) {
+        return !rx_ring.isNull() && rx_ring->pop(payload);
+    }
+    qint64 get_queued_bytes() {
+        QMutexLocker locker(&out_mutex);
+        return out_bytes;
+    }
+    /*Loop thread only, e.g. from handler callbacks*/
+    inline bool send_Msg(const QByteArray& msg);
+    inline void close();
+private:
+    /*Read until EAGAIN, returns false when connection has to be dropped*/
+    bool handle_readable(IEpollHandler* handler) {
+        while(true) {
+            qint64 bytes_read = read_buffer.fill_from(descriptor);
+            if(bytes_read == 0) return false;
+            if(bytes_read < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            if(buffer_parser_ptr.isNull()) {
+                read_buffer.reset();
+                continue;
+            }
+            while(!read_buffer.isEmpty()) {
+                qint64 consumed = buffer_parser_ptr->parse(read_buffer.data(), read_buffer.size());
+                if(consumed < 0 || !buffer_parser_ptr->isValidMsg()) {
+                    buffer_parser_ptr->reset();
+                    read_buffer.reset();
+                    break;
+                }
+                read_buffer.consume(consumed);
+                if(buffer_parser_ptr->isEndMsg()) {
+                    if(handler != NULL) handler->on_msg_received(this);
+                    if(descriptor < 0) return true;
+                    buffer_parser_ptr->reset();
+                }
+                else if(consumed == 0) {
+                    break;
+                }
+            }
+        }
+    }
+    /*Write queued chunks with writev until queue is empty or socket is full, returns false on socket error*/
+    bool flush_out() {
+        QMutexLocker locker(&out_mutex);
+        while(!out_chunks.isEmpty()) {
+            iovec iov[MAX_IOV_COUNT];
+            int count = qMin(out_chunks.size(), MAX_IOV_COUNT);
+            for(int i = 0; i < count; ++i) {
+                const QByteArray& chunk = out_chunks.at(i);
+                int skip = i == 0 ? out_offset : 0;
+                iov[i].iov_base = const_cast<char*>(chunk.constData() + skip);
+                iov[i].iov_len = chunk.size() - skip;
+            }
+            ssize_t written = ::writev(descriptor, iov, count);
+            if(written < 0) {
+                if(errno == EINTR) continue;
+                if(errno != EAGAIN && errno != EWOULDBLOCK) return false;
+                want_write = true;
+                return true;
+            }
+            out_bytes -= written;
+            while(written > 0) {
+                qint64 left = out_chunks.first().size() - out_offset;
+                if(written < left) {
+                    out_offset += written;
+                    break;
+                }
+                written -= left;
+                out_offset = 0;
+                out_chunks.removeFirst();
+            }
+        }
+        want_write = false;
+        return true;
+    }
+
+    EpollLoop* loop;
+    int descriptor;
+    quint64 conn_id;
+    bool connecting;
+    bool local;
+    bool want_write;
+    int out_offset;
+    qint64 out_bytes;
+    QMutex out_mutex;
+    QList<QByteArray> out_chunks;
+    ReadBuffer read_buffer;
+    QSharedPointer<IBufferParser> buffer_parser_ptr;
+    QSharedPointer<ShmRing> tx_ring;
+    QSharedPointer<ShmRing> rx_ring;
+};
+
+/*Edge triggered epoll loop in its own thread. Readiness is dispatched straight to connections and handler,
+ * requests from other threads are queued under mutex and loop is woken up through eventfd*/
+class EpollLoop : public QThread {
+    Q_OBJECT
+public:
+    EpollLoop(IEpollHandler* handler_ = NULL, QObject* parent = NULL) : QThread(parent), handler(handler_), running(false), conn_count(0), wake_pending(false) {
+        epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        if(epoll_fd < 0 || wake_fd < 0 || ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) != 0) {
+            qDebug() << "Failed to initialize epoll loop: " << strerror(errno);
+        }
+    }
+    virtual ~EpollLoop() {
+        stop();
+        if(wake_fd >= 0) ::close(wake_fd);
+        if(epoll_fd >= 0) ::close(epoll_fd);
+    }
+
+    void set_handler(IEpollHandler* handler_) {
+        handler = handler_;
+    }
+    bool is_valid() const {
+        return epoll_fd >= 0 && wake_fd >= 0;
+    }
+    bool in_loop_thread() const {
+        return QThread::currentThread() == this;
+    }
+    /*Loop has to be started by it and not by QThread::start, so that stop called right after it
+     * is not overridden by thread entering run*/
+    void start_loop() {
+        running = true;
+        start();
+    }
+    void stop() {
+        if(!isRunning()) return;
+        running = false;
+        wake();
+        wait();
+    }
+    /*Take accepted descriptor, thread safe*/
+    void adopt_descriptor(const qintptr socket_descriptor, const quint64 conn_id) {
+        post(Request(AdoptRequest, conn_id, int(socket_descriptor)));
+    }
+    /*Start non blocking connect, handler->on_connected is called from loop thread when it is established.
+     * Host name resolution, if required, is blocking. Co-located server listening on local socket is reached through it*/
+    bool connectToHost(const QString& host, const quint16 port, const quint64 conn_id) {
+        QHostAddress address(host);
+        if(address.isNull()) {
+            QHostInfo info = QHostInfo::fromName(host);
+            if(info.addresses().isEmpty()) return false;
+            address = info.addresses().first();
+        }
+        if(is_local_address(address)) {
+            QString path = local_socket_path(port);
+            if(!path.isEmpty() && QFile::exists(path) && connectToLocal(path, conn_id)) return true;
+        }
+        sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        memset(&addr, 0, sizeof(addr));
+        if(address.protocol() == QAbstractSocket::IPv6Protocol) {
+            sockaddr_in6* addr6 = reinterpret_cast<sockaddr_in6*>(&addr);
+            addr6->sin6_family = AF_INET6;
+            addr6->sin6_port = htons(port);
+            Q_IPV6ADDR ip6 = address.toIPv6Address();
+            memcpy(&addr6->sin6_addr, &ip6, sizeof(ip6));
+            addr_len = sizeof(sockaddr_in6);
+        }
+        else {
+            sockaddr_in* addr4 = reinterpret_cast<sockaddr_in*>(&addr);
+            addr4->sin_family = AF_INET;
+            addr4->sin_port = htons(port);
+            addr4->sin_addr.s_addr = htonl(address.toIPv4Address());
+            addr_len = sizeof(sockaddr_in);
+        }
+        int descriptor = ::socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(descriptor < 0) return false;
+        if(::connect(descriptor, reinterpret_cast<sockaddr*>(&addr), addr_len) != 0 && errno != EINPROGRESS) {
+            ::close(descriptor);
+            return false;
+        }
+        post(Request(ConnectRequest, conn_id, descriptor));
+        return true;
+    }
+    bool connectToLocal(const QString& path, const quint64 conn_id) {
+        sockaddr_un addr;
+        if(!fill_unix_address(path, addr)) return false;
+        int descriptor = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(descriptor < 0) return false;
+        /*Unix socket connects at once or not at all, server has to run as the same user*/
+        if(::connect(descriptor, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || !is_same_user_peer(descriptor)) {
+            ::close(descriptor);
+            return false;
+        }
+        post(Request(AdoptRequest, conn_id, descriptor));
+        return true;
+    }
+    /*Thread safe send by connection id, the only way to reach connection from other threads*/
+    void send_to(const quint64 conn_id, const QByteArray& msg) {
+        Request request(SendRequest, conn_id);
+        request.msg = msg;
+        post(request);
+    }
+    void close_conn(const quint64 conn_id) {
+        post(Request(CloseRequest, conn_id));
+    }
+    /*Connection is valid in loop thread only*/
+    EpollConnection* find_conn(const quint64 conn_id) const {
+        return connections.value(conn_id, NULL);
+    }
+    int get_conn_count() const {
+        return conn_count.load();
+    }
+protected:
+    virtual void run() {
+        epoll_event events[EPOLL_MAX_EVENTS];
+        while(running) {
+            int count = ::epoll_wait(epoll_fd, events, EPOLL_MAX_EVENTS, -1);
+            if(count < 0) {
+                if(errno == EINTR) continue;
+                qDebug() << "epoll_wait failed: " << strerror(errno);
+                break;
+            }
+            for(int i = 0; i < count; ++i) {
+                EpollConnection* conn = static_cast<EpollConnection*>(events[i].data.ptr);
+                if(conn == NULL) {
+                    process_requests();
+                    continue;
+                }
+                if(conn->descriptor < 0) continue;
+                handle_events(conn, events[i].events);
+            }
+            qDeleteAll(closed_connections);
+            closed_connections.clear();
+        }
+        foreach(EpollConnection* conn, connections) {
+            drop(conn);
+        }
+        qDeleteAll(closed_connections);
+        closed_connections.clear();
+    }
+private:
+    enum RequestType {
+        AdoptRequest = 0,
+        ConnectRequest,
+        SendRequest,
+        FlushRequest,
+        CloseRequest
+    };
+    struct Request {
+        Request(const RequestType type_ = FlushRequest, const quint64 conn_id_ = 0, const int descriptor_ = -1) : type(type_), conn_id(conn_id_), descriptor(descriptor_) {}
+        RequestType type;
+        quint64 conn_id;
+        int descriptor;
+        QByteArray msg;
+    };
+    void post(const Request& request) {
+        bool need_wake = false;
+        {
+            QMutexLocker locker(&request_mutex);
+            requests.append(request);
+            need_wake = !wake_pending;
+            wake_pending = true;
+        }
+        if(need_wake) wake();
+    }
+    void wake() {
+        quint64 value = 1;
+        if(::write(wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+            qDebug() << "Failed to wake epoll loop: " << strerror(errno);
+        }
+    }
+    void process_requests() {
+        quint64 value = 0;
+        while(::read(wake_fd, &value, sizeof(value)) > 0) {}
+        QVector<Request> batch;
+        {
+            QMutexLocker locker(&request_mutex);
+            batch.swap(requests);
+            wake_pending = false;
+        }
+        for(int i = 0; i < batch.size(); ++i) {
+            Request& request = batch[i];
+            if(request.type == AdoptRequest || request.type == ConnectRequest) {
+                attach(request.descriptor, request.conn_id, request.type == ConnectRequest);
+                continue;
+            }
+            EpollConnection* conn = connections.value(request.conn_id, NULL);
+            if(conn == NULL) continue;
+            if(request.type == CloseRequest) {
+                drop(conn);
+                continue;
+            }
+            if(request.type == SendRequest) {
+                QMutexLocker locker(&conn->out_mutex);
+                conn->out_chunks.append(request.msg);
+                conn->out_bytes += request.msg.size();
+            }
+            if(!conn->connecting) flush(conn);
+        }
+    }
+    void attach(const int descriptor, const quint64 conn_id, const bool connecting) {
+        ::fcntl(descriptor, F_SETFL, ::fcntl(descriptor, F_GETFL, 0) | O_NONBLOCK);
+        sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+        bool local = ::getsockname(descriptor, reinterpret_cast<sockaddr*>(&addr), &addr_len) == 0 && addr.ss_family == AF_UNIX;
+        if(!local) {
+            int no_delay = 1;
+            ::setsockopt(descriptor, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        }
+        EpollConnection* conn = new EpollConnection(this, descriptor, conn_id);
+        conn->connecting = connecting;
+        conn->local = local;
+        epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (connecting ? EPOLLOUT : 0);
+        event.data.ptr = conn;
+        if(::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, descriptor, &event) != 0) {
+            qDebug() << "Failed to add descriptor to epoll: " << strerror(errno);
+            delete conn;
+            return;
+        }
+        connections.insert(conn_id, conn);
+        ++conn_count;
+        if(!connecting && handler != NULL) handler->on_connected(conn);
+    }
+    void handle_events(EpollConnection* conn, const quint32 events) {
+        if(conn->connecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            int error = 0;
+            socklen_t error_len = sizeof(error);
+            ::getsockopt(conn->descriptor, SOL_SOCKET, SO_ERROR, &error, &error_len);
+            if(error != 0) {
+                qDebug() << "Connect failed: " << strerror(error);
+                drop(conn);
+                return;
+            }
+            conn->connecting = false;
+            if(handler != NULL) handler->on_connected(conn);
+            if(conn->descriptor < 0) return;
+            flush(conn);
+        }
+        if(events & EPOLLERR) {
+            drop(conn);
+            return;
+        }
+        if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+            if(!conn->handle_readable(handler)) {
+                drop(conn);
+                return;
+            }
+            if(conn->descriptor < 0) return;
+        }
+        if((events & EPOLLOUT) && conn->want_write) flush(conn);
+    }
+    /*EPOLLOUT is watched only while socket buffer is full*/
+    void flush(EpollConnection* conn) {
+        bool had_want_write = conn->want_write;
+        if(!conn->flush_out()) {
+            drop(conn);
+            return;
+        }
+        if(had_want_write == conn->want_write) return;
+        epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (conn->want_write ? EPOLLOUT : 0);
+        event.data.ptr = conn;
+        ::epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->descriptor, &event);
+    }
+    /*Connection is deleted after current batch of events, so later events of the batch do not touch freed memory*/
+    void drop(EpollConnection* conn) {
+        if(conn->descriptor < 0) return;
+        ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->descriptor, NULL);
+        ::close(conn->descriptor);
+        conn->descriptor = -1;
+        connections.remove(conn->conn_id);
+        --conn_count;
+        closed_connections.append(conn);
+        if(handler != NULL) handler->on_connection_closed(conn);
+    }
+
+    friend class EpollConnection;
+    IEpollHandler* handler;
+    int epoll_fd;
+    int wake_fd;
+    std::atomic<bool> running;
+    std::atomic<int> conn_count;
+    bool wake_pending;
+    QMutex request_mutex;
+    QVector<Request> requests;
+    QHash<quint64, EpollConnection*> connections;
+    QList<EpollConnection*> closed_connections;
+};
+
+inline bool EpollConnection::send_Msg(const QByteArray& msg) {
+    Q_ASSERT(loop->in_loop_thread());
+    if(descriptor < 0) return false;
+    {
+        QMutexLocker locker(&out_mutex);
+        out_chunks.append(msg);
+        out_bytes += msg.size();
+    }
+    if(!connecting) loop->flush(this);
+    return true;
+}
+
+inline void EpollConnection::close() {
+    Q_ASSERT(loop->in_loop_thread());
+    loop->drop(this);
+}
+
+#endif // Q_OS_LINUX
+
+#endif // EPOLLTRANSPORT_H
@@ -0,0 +1,64 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef FRAMING_H
+#define FRAMING_H
+#pragma once
+#include <QtCore>
+
+#define FRAME_HEADER_SIZE 8
+#define MAX_FRAME_SIZE 67108864
+/*Frame type reserved for connection handshake, such frames are consumed by connection itself*/
+#define FRAME_TYPE_HANDSHAKE 0xFFFF
+#define HANDSHAKE_VERSION 1
+
+/*Fixed size header preceding every frame in length prefixed mode.
+ * Layout on the wire (network byte order): payload length (4 bytes), frame type (2 bytes), frame flags (2 bytes)*/
+struct FrameHeader {
+    enum Flags {
+        /*Payload starts with 4 byte stream id, see StreamMultiplexer*/
+        StreamChunkFlag = 0x0001,
+        /*Last chunk of message sent over stream*/
+        StreamEndFlag = 0x0002,
+        /*Payload is LZ compressed block preceded by its raw size, see LZCodec*/
+        CompressedFlag = 0x0004
+    };
+    /*Capability bits announced in handshake frame payload: version (2 bytes), capabilities (2 bytes)*/
+    enum Capabilities {
+        CompressionCapability = 0x0001
+    };
+    FrameHeader(const quint32 length_ = 0, const quint16 type_ = 0, const quint16 flags_ = 0) :
+        length(length_), type(type_), flags(flags_) {}
+
+    void write_to(char* dst) const {
+        qToBigEndian<quint32>(length, reinterpret_cast<uchar*>(dst));
+        qToBigEndian<quint16>(type, reinterpret_cast<uchar*>(dst + 4));
+        qToBigEndian<quint16>(flags, reinterpret_cast<uchar*>(dst + 6));
+    }
+    bool read_from(const char* src) {
+        length = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(src));
+        type = qFromBigEndian<quint16>(reinterpret_cast<const uchar*>(src + 4));
+        flags = qFromBigEndian<quint16>(reinterpret_cast<const uchar*>(src + 6));
+        return length <= MAX_FRAME_SIZE;
+    }
+    quint32 length;
+    quint16 type;
+    quint16 flags;
+};
+
+#endif // FRAMING_H
@@ -0,0 +1,188 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef LOCALTRANSPORT_H
+#define LOCALTRANSPORT_H
+#pragma once
+#include <QtNetwork>
+
+#include "shmring.h"
+
+/*Unix domain socket transport for co-located nodes. It is served only by epoll backend: TCPServer listens
+ * on local socket while start_epoll_loops is active and EpollLoop::connectToHost dials it for local addresses.
+ * Default QTcpSocket path of TCPServer and TCPConnection keeps using TCP loopback. Shared memory rings
+ * for bulk payloads are not negotiated by transport, application creates them and announces ring names
+ * to peer in its own messages before attaching them by EpollConnection::set_bulk_rings*/
+
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define LOCAL_RUNTIME_DIR_NAME "distributedservice"
+#define LOCAL_RUNTIME_DIR_ENV "DISTRIBUTEDSERVICE_RUNTIME_DIR"
+#define LOCAL_SOCKET_NAME_TEMPLATE "%1.sock"
+
+inline QString& local_runtime_dir_override() {
+    static QString runtime_dir;
+    return runtime_dir;
+}
+
+/*Directory for local sockets, set before servers and clients start*/
+inline void set_local_runtime_dir(const QString& runtime_dir) {
+    local_runtime_dir_override() = runtime_dir;
+}
+
+/*Directory has to be owned by this user and closed to others, it is created when missing.
+ * Symlinks are refused, so nobody else can redirect sockets placed in it*/
+inline bool ensure_private_dir(const QString& dir) {
+    QByteArray native_dir = QFile::encodeName(dir);
+    if(::mkdir(native_dir.constData(), S_IRWXU) != 0 && errno != EEXIST) return false;
+    struct stat info;
+    if(::lstat(native_dir.constData(), &info) != 0) return false;
+    return S_ISDIR(info.st_mode) && info.st_uid == ::geteuid() && (info.st_mode & (S_IRWXG | S_IRWXO)) == 0;
+}
+
+/*Configured directory, then DISTRIBUTEDSERVICE_RUNTIME_DIR, then XDG_RUNTIME_DIR, then per user directory in /tmp.
+ * Empty when directory is not private*/
+inline QString local_runtime_dir() {
+    QString dir = local_runtime_dir_override();
+    if(dir.isEmpty()) dir = QString::fromLocal8Bit(qgetenv(LOCAL_RUNTIME_DIR_ENV));
+    if(dir.isEmpty()) {
+        QString xdg_dir = QString::fromLocal8Bit(qgetenv("XDG_RUNTIME_DIR"));
+        if(!xdg_dir.isEmpty()) dir = xdg_dir + QLatin1Char('/') + QLatin1String(LOCAL_RUNTIME_DIR_NAME);
+    }
+    if(dir.isEmpty()) dir = QString("/tmp/%1-%2").arg(LOCAL_RUNTIME_DIR_NAME).arg(::geteuid());
+    return ensure_private_dir(dir) ? dir : QString();
+}
+
+/*Unix domain socket path serving TCP port of co-located server, empty when there is no private directory for it*/
+inline QString local_socket_path(const quint16 port) {
+    QString dir = local_runtime_dir();
+    if(dir.isEmpty()) return QString();
+    return dir + QLatin1Char('/') + QString(LOCAL_SOCKET_NAME_TEMPLATE).arg(port);
+}
+
+/*Both ends of local socket must run as the same user*/
+inline bool is_same_user_peer(const int descriptor) {
+#ifdef SO_PEERCRED
+    struct ucred credentials;
+    socklen_t credentials_len = sizeof(credentials);
+    if(::getsockopt(descriptor, SOL_SOCKET, SO_PEERCRED, &credentials, &credentials_len) != 0) return false;
+    return credentials.uid == ::geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    if(::getpeereid(descriptor, &uid, &gid) != 0) return false;
+    return uid == ::geteuid();
+#endif
+}
+
+/*Peer runs on this host when address is loopback or belongs to one of local interfaces*/
+inline bool is_local_address(const QHostAddress& address) {
+    if(address.isLoopback()) return true;
+    static const QList<QHostAddress> local_addresses = QNetworkInterface::allAddresses();
+    return local_addresses.contains(address);
+}
+
+inline bool fill_unix_address(const QString& path, sockaddr_un& addr) {
+    QByteArray native_path = QFile::encodeName(path);
+    if(native_path.size() >= int(sizeof(addr.sun_path))) return false;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, native_path.constData(), native_path.size());
+    return true;
+}
+
+/*Listening Unix domain socket watched by server thread, accepted descriptors are handed over by signal
+ * the same way QTcpServer hands them to incomingConnection. Socket is open to owner only and peers
+ * running as other users are refused*/
+class LocalListener : public QObject {
+    Q_OBJECT
+public:
+    LocalListener(QObject* parent = NULL) : QObject(parent), descriptor(-1) {}
+    virtual ~LocalListener() {
+        close();
+    }
+
+    bool listen(const QString& path_) {
+        close();
+        if(path_.isEmpty()) return false;
+        sockaddr_un addr;
+        if(!fill_unix_address(path_, addr)) return false;
+        descriptor = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(descriptor < 0) return false;
+        /*Stale socket of previous run, path is inside private directory so nobody else could place it there*/
+        ::unlink(addr.sun_path);
+        if(::bind(descriptor, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::chmod(addr.sun_path, S_IRUSR | S_IWUSR) != 0 ||
+           ::listen(descriptor, SOMAXCONN) != 0) {
+            qDebug() << "Failed to listen on local socket " << path_ << ": " << strerror(errno);
+            ::close(descriptor);
+            descriptor = -1;
+            return false;
+        }
+        path = path_;
+        notifier.reset(new QSocketNotifier(descriptor, QSocketNotifier::Read));
+        connect(notifier.data(), SIGNAL(activated(int)), this, SLOT(onActivated()));
+        return true;
+    }
+    void close() {
+        notifier.reset();
+        if(descriptor < 0) return;
+        ::close(descriptor);
+        descriptor = -1;
+        QFile::remove(path);
+        path.clear();
+    }
+    bool isListening() const {
+        return descriptor >= 0;
+    }
+    QString get_path() const {
+        return path;
+    }
+signals:
+    void descriptor_accepted(qintptr socket_descriptor);
+private slots:
+    void onActivated() {
+        while(true) {
+            int accepted = ::accept4(descriptor, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(accepted < 0) {
+                if(errno == EINTR) continue;
+                if(errno != EAGAIN && errno != EWOULDBLOCK) qDebug() << "Local accept failed: " << strerror(errno);
+                return;
+            }
+            if(!is_same_user_peer(accepted)) {
+                qDebug() << "Local connection from other user is refused";
+                ::close(accepted);
+                continue;
+            }
+            emit descriptor_accepted(accepted);
+        }
+    }
+private:
+    int descriptor;
+    QString path;
+    QSharedPointer<QSocketNotifier> notifier;
+};
+
+#endif // Q_OS_UNIX
+
+#endif // LOCALTRANSPORT_H
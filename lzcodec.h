@@ -0,0 +1,233 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef LZCODEC_H
+#define LZCODEC_H
+#pragma once
+#include <QtCore>
+
+#include <cstring>
+
+#include "framing.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_FIND_LIMIT 12
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+#define LZ_RAW_SIZE_BYTES 4
+#define DEFAULT_COMPRESS_THRESHOLD 512
+#define MAX_INCOMPRESSIBLE_SKIP 64
+
+/*Fast byte oriented LZ77 codec producing LZ4 block format: sequences of [token][literals][offset][match length],
+ * greedy matcher with 4096 entry hash table, no entropy coding. Decoder checks every length and offset against
+ * both buffers, so corrupted or hostile input fails instead of reading or writing out of bounds.
+ * QByteArray helpers prepend raw size (4 bytes, network byte order) to compressed block*/
+class LZCodec {
+public:
+    static int max_compressed_size(const int size) {
+        return size + size / 255 + 16;
+    }
+    /*Returns compressed size or 0 when output does not fit into dst_capacity*/
+    static int compress(const char* src, const int src_size, char* dst, const int dst_capacity) {
+        const uchar* in = reinterpret_cast<const uchar*>(src);
+        const uchar* ip = in;
+        const uchar* anchor = in;
+        const uchar* in_end = in + src_size;
+        uchar* op = reinterpret_cast<uchar*>(dst);
+        uchar* out_end = op + dst_capacity;
+        if(src_size > LZ_MATCH_FIND_LIMIT) {
+            int table[1 << LZ_HASH_BITS];
+            memset(table, 0, sizeof(table));
+            const uchar* match_find_end = in_end - LZ_MATCH_FIND_LIMIT;
+            const uchar* match_end = in_end - LZ_LAST_LITERALS;
+            int misses = 0;
+            ++ip;
+            while(ip < match_find_end) {
+                quint32 sequence = read32(ip);
+                quint32 hash = (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+                const uchar* ref = in + table[hash];
+                table[hash] = int(ip - in);
+                if(ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != sequence) {
+                    /*Step grows on incompressible data*/
+                    ip += 1 + (misses++ >> 6);
+                    continue;
+                }
+                misses = 0;
+                while(ip > anchor && ref > in && ip[-1] == ref[-1]) {
+                    --ip;
+                    --ref;
+                }
+                const uchar* match_ptr = ip + LZ_MIN_MATCH;
+                const uchar* ref_ptr = ref + LZ_MIN_MATCH;
+                while(match_ptr < match_end && *match_ptr == *ref_ptr) {
+                    ++match_ptr;
+                    ++ref_ptr;
+                }
+                int literal_length = int(ip - anchor);
+                int match_length = int(match_ptr - ip) - LZ_MIN_MATCH;
+                if(out_end - op < 1 + literal_length + literal_length / 255 + 3 + match_length / 255 + 1) return 0;
+                uchar* token = op++;
+                *token = uchar(qMin(literal_length, 15) << 4);
+                op = write_length(op, literal_length);
+                memcpy(op, anchor, literal_length);
+                op += literal_length;
+                int offset = int(ip - ref);
+                *op++ = uchar(offset & 0xFF);
+                *op++ = uchar(offset >> 8);
+                *token |= uchar(qMin(match_length, 15));
+                op = write_length(op, match_length);
+                ip = anchor = match_ptr;
+            }
+        }
+        int literal_length = int(in_end - anchor);
+        if(out_end - op < 1 + literal_length + literal_length / 255 + 1) return 0;
+        *op++ = uchar(qMin(literal_length, 15) << 4);
+        op = write_length(op, literal_length);
+        memcpy(op, anchor, literal_length);
+        op += literal_length;
+        return int(op - reinterpret_cast<uchar*>(dst));
+    }
+    /*Output has to be exactly dst_size bytes, returns false on malformed input*/
+    static bool decompress(const char* src, const int src_size, char* dst, const int dst_size) {
+        const uchar* ip = reinterpret_cast<const uchar*>(src);
+        const uchar* in_end = ip + src_size;
+        uchar* out = reinterpret_cast<uchar*>(dst);
+        uchar* op = out;
+        uchar* out_end = out + dst_size;
+        while(ip < in_end) {
+            uchar token = *ip++;
+            qint64 literal_length = token >> 4;
+            if(literal_length == 15 && !read_length(ip, in_end, literal_length)) return false;
+            if(literal_length > in_end - ip || literal_length > out_end - op) return false;
+            memcpy(op, ip, literal_length);
+            op += literal_length;
+            ip += literal_length;
+            if(ip == in_end) break;
+            if(in_end - ip < 2) return false;
+            int offset = ip[0] | (ip[1] << 8);
+            ip += 2;
+            if(offset == 0 || offset > op - out) return false;
+            qint64 match_length = token & 15;
+            if(match_length == 15 && !read_length(ip, in_end, match_length)) return false;
+            match_length += LZ_MIN_MATCH;
+            if(match_length > out_end - op) return false;
+            const uchar* match = op - offset;
+            for(qint64 i = 0; i < match_length; ++i) {
+                op[i] = match[i];
+            }
+            op += match_length;
+        }
+        return op == out_end;
+    }
+    static bool compress(const QByteArray& src, QByteArray& dst) {
+        dst.resize(LZ_RAW_SIZE_BYTES + max_compressed_size(src.size()));
+        qToBigEndian<quint32>(src.size(), reinterpret_cast<uchar*>(dst.data()));
+        int size = compress(src.constData(), src.size(), dst.data() + LZ_RAW_SIZE_BYTES, dst.size() - LZ_RAW_SIZE_BYTES);
+        if(size == 0) return false;
+        dst.resize(LZ_RAW_SIZE_BYTES + size);
+        return true;
+    }
+    static bool decompress(const char* src, const int src_size, QByteArray& dst) {
+        if(src_size < LZ_RAW_SIZE_BYTES) return false;
+        quint32 raw_size = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(src));
+        /*Block can not expand more than 255 times, claimed size is checked before memory is taken for it*/
+        if(raw_size > MAX_FRAME_SIZE || raw_size > quint64(src_size - LZ_RAW_SIZE_BYTES) * 255 + 16) return false;
+        dst.resize(raw_size);
+        return decompress(src + LZ_RAW_SIZE_BYTES, src_size - LZ_RAW_SIZE_BYTES, dst.data(), raw_size);
+    }
+private:
+    static quint32 read32(const uchar* ptr) {
+        quint32 value;
+        memcpy(&value, ptr, sizeof(value));
+        return value;
+    }
+    static uchar* write_length(uchar* op, int length) {
+        if(length < 15) return op;
+        length -= 15;
+        while(length >= 255) {
+            *op++ = 255;
+            length -= 255;
+        }
+        *op++ = uchar(length);
+        return op;
+    }
+    static bool read_length(const uchar*& ip, const uchar* in_end, qint64& length) {
+        uchar byte = 255;
+        while(byte == 255) {
+            if(ip >= in_end) return false;
+            byte = *ip++;
+            length += byte;
+        }
+        return true;
+    }
+};
+
+/*Sending side policy: payloads under threshold go as is, compressed payload is used only when it saves
+ * at least 1/8 of size. After every incompressible payload twice as many following payloads are sent
+ * without trying, up to MAX_INCOMPRESSIBLE_SKIP, so already compressed media costs almost nothing*/
+class AdaptiveCompressor {
+public:
+    AdaptiveCompressor(const int threshold_ = DEFAULT_COMPRESS_THRESHOLD) : threshold(threshold_), skip_span(0), skip_left(0),
+                                                                            compressed_count(0), skipped_count(0), saved_bytes(0) {}
+    virtual ~AdaptiveCompressor() {}
+
+    void set_threshold(const int threshold_) {
+        threshold = threshold_;
+    }
+    int get_threshold() const {
+        return threshold;
+    }
+    /*Returns true when compressed holds payload to send instead of original one*/
+    bool compress(const QByteArray& payload, QByteArray& compressed) {
+        if(payload.size() < threshold) return false;
+        if(skip_left > 0) {
+            --skip_left;
+            ++skipped_count;
+            return false;
+        }
+        if(LZCodec::compress(payload, compressed) && compressed.size() <= payload.size() - payload.size() / 8) {
+            skip_span = 0;
+            ++compressed_count;
+            saved_bytes += payload.size() - compressed.size();
+            return true;
+        }
+        skip_span = qMin(MAX_INCOMPRESSIBLE_SKIP, qMax(1, 2 * skip_span));
+        skip_left = skip_span;
+        ++skipped_count;
+        return false;
+    }
+    quint64 get_compressed_count() const {
+        return compressed_count;
+    }
+    quint64 get_skipped_count() const {
+        return skipped_count;
+    }
+    quint64 get_saved_bytes() const {
+        return saved_bytes;
+    }
+private:
+    int threshold;
+    int skip_span;
+    int skip_left;
+    quint64 compressed_count;
+    quint64 skipped_count;
+    quint64 saved_bytes;
+};
+
+#endif // LZCODEC_H
@@ -0,0 +1,239 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef METRICS_H
+#define METRICS_H
+#pragma once
+#include <QtCore>
+
+#include <atomic>
+#include <chrono>
+
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_SUB_BUCKET_COUNT (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_MAX_MAGNITUDE 36
+#define HISTOGRAM_BUCKET_COUNT (HISTOGRAM_SUB_BUCKET_COUNT * (HISTOGRAM_MAX_MAGNITUDE - HISTOGRAM_SUB_BUCKET_BITS + 2))
+
+inline qint64 metrics_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*Counter with single writer thread, plain load and store avoid locked add, readers of any thread see consistent values*/
+inline void bump(std::atomic<quint64>& counter, const quint64 value = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/*Copy of histogram counts, can be merged and queried for percentiles*/
+struct HistogramSnapshot {
+    HistogramSnapshot() : counts(HISTOGRAM_BUCKET_COUNT, 0), total_count(0), max_value(0) {}
+
+    void merge(const HistogramSnapshot& other) {
+        for(int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i) {
+            counts[i] += other.counts.at(i);
+        }
+        total_count += other.total_count;
+        max_value = qMax(max_value, other.max_value);
+    }
+    /*Upper bound of bucket holding requested percentile, 0 when histogram is empty*/
+    quint64 value_at_percentile(const double percentile) const;
+
+    QVector<quint64> counts;
+    quint64 total_count;
+    quint64 max_value;
+};
+
+/*HDR style log linear histogram of nanosecond values: 16 linear sub buckets for every power of two,
+ * which keeps relative error under 6.25% from 1 ns up to about 137 s. Single writer, lock free readers*/
+class LatencyHistogram {
+public:
+    LatencyHistogram() : total_count(0), max_value(0) {
+        for(int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i) {
+            counts[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    virtual ~LatencyHistogram() {}
+
+    void record(const qint64 value) {
+        quint64 sample = value > 0 ? quint64(value) : 0;
+        bump(counts[bucket_index(sample)]);
+        bump(total_count);
+        if(sample > max_value.load(std::memory_order_relaxed)) max_value.store(sample, std::memory_order_relaxed);
+    }
+    void snapshot(HistogramSnapshot& snapshot) const {
+        for(int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i) {
+            snapshot.counts[i] = counts[i].load(std::memory_order_relaxed);
+        }
+        snapshot.total_count = total_count.load(std::memory_order_relaxed);
+        snapshot.max_value = max_value.load(std::memory_order_relaxed);
+    }
+    static int bucket_index(const quint64 value) {
+        if(value < HISTOGRAM_SUB_BUCKET_COUNT) return int(value);
+        int magnitude = 63 - __builtin_clzll(value);
+        if(magnitude > HISTOGRAM_MAX_MAGNITUDE) return HISTOGRAM_BUCKET_COUNT - 1;
+        int shift = magnitude - HISTOGRAM_SUB_BUCKET_BITS;
+        int sub_bucket = int(value >> shift) - HISTOGRAM_SUB_BUCKET_COUNT;
+        return HISTOGRAM_SUB_BUCKET_COUNT * (shift + 1) + sub_bucket;
+    }
+    static quint64 bucket_upper_bound(const int index) {
+        if(index < HISTOGRAM_SUB_BUCKET_COUNT) return quint64(index);
+        int shift = index / HISTOGRAM_SUB_BUCKET_COUNT - 1;
+        quint64 sub_bucket = quint64(index % HISTOGRAM_SUB_BUCKET_COUNT + HISTOGRAM_SUB_BUCKET_COUNT);
+        return ((sub_bucket + 1) << shift) - 1;
+    }
+private:
+    std::atomic<quint64> counts[HISTOGRAM_BUCKET_COUNT];
+    std::atomic<quint64> total_count;
+    std::atomic<quint64> max_value;
+};
+
+inline quint64 HistogramSnapshot::value_at_percentile(const double percentile) const {
+    if(total_count == 0) return 0;
+    quint64 rank = quint64(qBound(0.0, percentile, 100.0) / 100.0 * total_count + 0.5);
+    if(rank == 0) rank = 1;
+    quint64 seen = 0;
+    for(int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i) {
+        seen += counts.at(i);
+        if(seen >= rank) return qMin(LatencyHistogram::bucket_upper_bound(i), max_value);
+    }
+    return max_value;
+}
+
+struct MetricsSnapshot {
+    MetricsSnapshot() : bytes_in(0), bytes_out(0), msgs_in(0), msgs_out(0), parse_errors(0), reconnects(0), connections(0) {}
+
+    void merge(const MetricsSnapshot& other) {
+        bytes_in += other.bytes_in;
+        bytes_out += other.bytes_out;
+        msgs_in += other.msgs_in;
+        msgs_out += other.msgs_out;
+        parse_errors += other.parse_errors;
+        reconnects += other.reconnects;
+        connections += other.connections;
+        parse_time.merge(other.parse_time);
+        receive_latency.merge(other.receive_latency);
+    }
+    quint64 bytes_in;
+    quint64 bytes_out;
+    quint64 msgs_in;
+    quint64 msgs_out;
+    quint64 parse_errors;
+    quint64 reconnects;
+    quint64 connections;
+    /*Time spent inside parser per message*/
+    HistogramSnapshot parse_time;
+    /*Time from arrival of first byte of message to msg_received*/
+    HistogramSnapshot receive_latency;
+};
+
+/*Counters of one connection, written by connection thread only and read from any thread*/
+class ConnectionMetrics {
+public:
+    ConnectionMetrics() : bytes_in(0), bytes_out(0), msgs_in(0), msgs_out(0), parse_errors(0), reconnects(0) {}
+    virtual ~ConnectionMetrics() {}
+
+    void add_bytes_in(const quint64 bytes) {
+        bump(bytes_in, bytes);
+    }
+    void add_msg_out(const quint64 bytes) {
+        bump(bytes_out, bytes);
+        bump(msgs_out);
+    }
+    void add_msg_in(const qint64 parse_ns, const qint64 latency_ns) {
+        bump(msgs_in);
+        parse_time.record(parse_ns);
+        receive_latency.record(latency_ns);
+    }
+    void add_parse_error() {
+        bump(parse_errors);
+    }
+    void add_reconnect() {
+        bump(reconnects);
+    }
+    void snapshot(MetricsSnapshot& snapshot) const {
+        snapshot.bytes_in = bytes_in.load(std::memory_order_relaxed);
+        snapshot.bytes_out = bytes_out.load(std::memory_order_relaxed);
+        snapshot.msgs_in = msgs_in.load(std::memory_order_relaxed);
+        snapshot.msgs_out = msgs_out.load(std::memory_order_relaxed);
+        snapshot.parse_errors = parse_errors.load(std::memory_order_relaxed);
+        snapshot.reconnects = reconnects.load(std::memory_order_relaxed);
+        snapshot.connections = 1;
+        parse_time.snapshot(snapshot.parse_time);
+        receive_latency.snapshot(snapshot.receive_latency);
+    }
+private:
+    std::atomic<quint64> bytes_in;
+    std::atomic<quint64> bytes_out;
+    std::atomic<quint64> msgs_in;
+    std::atomic<quint64> msgs_out;
+    std::atomic<quint64> parse_errors;
+    std::atomic<quint64> reconnects;
+    LatencyHistogram parse_time;
+    LatencyHistogram receive_latency;
+};
+
+/*Server wide view: live connections are summed when snapshot is taken, metrics of closed connections
+ * are folded into retired totals, so I/O threads never write shared counters*/
+class MetricsAggregate {
+public:
+    MetricsAggregate() {}
+    virtual ~MetricsAggregate() {}
+
+    void attach(const quint64 conn_id, QSharedPointer<ConnectionMetrics> metrics) {
+        QMutexLocker locker(&lock);
+        live.insert(conn_id, metrics);
+    }
+    void retire(const quint64 conn_id) {
+        QMutexLocker locker(&lock);
+        QSharedPointer<ConnectionMetrics> metrics = live.take(conn_id);
+        if(metrics.isNull()) return;
+        MetricsSnapshot snapshot;
+        metrics->snapshot(snapshot);
+        retired.merge(snapshot);
+    }
+    /*Totals of live and closed connections, connections counts live ones only*/
+    MetricsSnapshot snapshot() const {
+        QMutexLocker locker(&lock);
+        MetricsSnapshot total = retired;
+        total.connections = 0;
+        QHash<quint64, QSharedPointer<ConnectionMetrics> >::const_iterator iter = live.constBegin();
+        while(iter != live.constEnd()) {
+            MetricsSnapshot snapshot;
+            iter.value()->snapshot(snapshot);
+            total.merge(snapshot);
+            ++iter;
+        }
+        return total;
+    }
+    bool snapshot(const quint64 conn_id, MetricsSnapshot& snapshot) const {
+        QMutexLocker locker(&lock);
+        QSharedPointer<ConnectionMetrics> metrics = live.value(conn_id);
+        if(metrics.isNull()) return false;
+        metrics->snapshot(snapshot);
+        return true;
+    }
+    QList<quint64> get_conn_ids() const {
+        QMutexLocker locker(&lock);
+        return live.keys();
+    }
+private:
+    mutable QMutex lock;
+    QHash<quint64, QSharedPointer<ConnectionMetrics> > live;
+    MetricsSnapshot retired;
+};
+
+#endif // METRICS_H
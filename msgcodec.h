@@ -0,0 +1,296 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef MSGCODEC_H
+#define MSGCODEC_H
+#pragma once
+#include <QtCore>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#include "IProtocol.h"
+
+#define MAX_VARINT_SIZE 10
+#define MIN_WRITER_CAPACITY 64
+
+/*Appends to caller's buffer, grows it geometrically and trims it once when writing is done*/
+class ByteWriter {
+public:
+    ByteWriter(QByteArray& buffer_) : buffer(buffer_), pos(buffer_.size()) {}
+    ~ByteWriter() {
+        buffer.resize(pos);
+    }
+
+    void write_varint(quint64 value) {
+        uchar* dst = reserve(MAX_VARINT_SIZE);
+        int size = 0;
+        while(value >= 0x80) {
+            dst[size++] = uchar(value) | 0x80;
+            value >>= 7;
+        }
+        dst[size++] = uchar(value);
+        pos += size;
+    }
+    void write_raw(const void* data, const int size) {
+        memcpy(reserve(size), data, size);
+        pos += size;
+    }
+private:
+    uchar* reserve(const int size) {
+        if(pos + size > buffer.size()) buffer.resize(qMax(qMax(2 * buffer.size(), pos + size), MIN_WRITER_CAPACITY));
+        return reinterpret_cast<uchar*>(buffer.data()) + pos;
+    }
+
+    QByteArray& buffer;
+    int pos;
+};
+
+/*Every read checks remaining size, reader stays at failed position on error*/
+class ByteReader {
+public:
+    ByteReader(const char* data, const int size) : ptr(reinterpret_cast<const uchar*>(data)), end(ptr + size) {}
+
+    bool read_varint(quint64& value) {
+        value = 0;
+        const uchar* cur = ptr;
+        for(int shift = 0; shift < 7 * MAX_VARINT_SIZE; shift += 7) {
+            if(cur == end) return false;
+            uchar byte = *cur++;
+            /*Tenth byte may carry only the highest bit*/
+            if(shift == 63 && byte > 1) return false;
+            value |= quint64(byte & 0x7F) << shift;
+            if((byte & 0x80) == 0) {
+                /*Zero last byte after continuation is non canonical encoding*/
+                if(byte == 0 && shift > 0) return false;
+                ptr = cur;
+                return true;
+            }
+        }
+        return false;
+    }
+    bool read_raw(void* data, const int size) {
+        if(size < 0 || end - ptr < size) return false;
+        memcpy(data, ptr, size);
+        ptr += size;
+        return true;
+    }
+    /*Borrow size bytes without copying*/
+    const char* take(const int size) {
+        if(size < 0 || end - ptr < size) return NULL;
+        const char* data = reinterpret_cast<const char*>(ptr);
+        ptr += size;
+        return data;
+    }
+    int remaining() const {
+        return int(end - ptr);
+    }
+private:
+    const uchar* ptr;
+    const uchar* end;
+};
+
+/*Unsigned integers and bool as LEB128 varint, decoding fails when value does not fit into field type*/
+struct VarintEncoding {
+    template<class T>
+    static void encode(const T& value, ByteWriter& writer) {
+        static_assert(!std::is_signed<T>::value, "varint fields have to be unsigned, use ZigZagEncoding");
+        writer.write_varint(quint64(value));
+    }
+    template<class T>
+    static bool decode(ByteReader& reader, T& value) {
+        static_assert(!std::is_signed<T>::value, "varint fields have to be unsigned, use ZigZagEncoding");
+        quint64 raw = 0;
+        if(!reader.read_varint(raw) || raw > quint64(std::numeric_limits<T>::max())) return false;
+        value = T(raw);
+        return true;
+    }
+};
+
+/*Signed integers, small magnitudes of both signs take few bytes*/
+struct ZigZagEncoding {
+    template<class T>
+    static void encode(const T& value, ByteWriter& writer) {
+        static_assert(std::is_signed<T>::value, "zigzag fields have to be signed, use VarintEncoding");
+        qint64 signed_value = qint64(value);
+        writer.write_varint((quint64(signed_value) << 1) ^ quint64(signed_value >> 63));
+    }
+    template<class T>
+    static bool decode(ByteReader& reader, T& value) {
+        static_assert(std::is_signed<T>::value, "zigzag fields have to be signed, use VarintEncoding");
+        quint64 raw = 0;
+        if(!reader.read_varint(raw)) return false;
+        qint64 signed_value = qint64(raw >> 1) ^ -qint64(raw & 1);
+        if(signed_value < qint64(std::numeric_limits<T>::min()) || signed_value > qint64(std::numeric_limits<T>::max())) return false;
+        value = T(signed_value);
+        return true;
+    }
+};
+
+/*Arithmetic types as they are in little endian byte order, floating point included*/
+struct FixedEncoding {
+    template<class T>
+    static void encode(const T& value, ByteWriter& writer) {
+        uchar bytes[sizeof(T)];
+        memcpy(bytes, &value, sizeof(T));
+        if(QSysInfo::ByteOrder == QSysInfo::BigEndian) std::reverse(bytes, bytes + sizeof(T));
+        writer.write_raw(bytes, sizeof(T));
+    }
+    template<class T>
+    static bool decode(ByteReader& reader, T& value) {
+        uchar bytes[sizeof(T)];
+        if(!reader.read_raw(bytes, sizeof(T))) return false;
+        if(QSysInfo::ByteOrder == QSysInfo::BigEndian) std::reverse(bytes, bytes + sizeof(T));
+        memcpy(&value, bytes, sizeof(T));
+        return true;
+    }
+};
+
+/*QByteArray as varint length followed by bytes*/
+struct BytesEncoding {
+    static void encode(const QByteArray& value, ByteWriter& writer) {
+        writer.write_varint(quint64(value.size()));
+        writer.write_raw(value.constData(), value.size());
+    }
+    static bool decode(ByteReader& reader, QByteArray& value) {
+        quint64 size = 0;
+        if(!reader.read_varint(size) || size > quint64(reader.remaining())) return false;
+        value = QByteArray(reader.take(int(size)), int(size));
+        return true;
+    }
+};
+
+/*QString as UTF-8 bytes*/
+struct Utf8Encoding {
+    static void encode(const QString& value, ByteWriter& writer) {
+        BytesEncoding::encode(value.toUtf8(), writer);
+    }
+    static bool decode(ByteReader& reader, QString& value) {
+        quint64 size = 0;
+        if(!reader.read_varint(size) || size > quint64(reader.remaining())) return false;
+        value = QString::fromUtf8(reader.take(int(size)), int(size));
+        return true;
+    }
+};
+
+/*Binding of struct member to its wire encoding, use MSG_FIELD to declare it*/
+template<class S, class T, T S::*Member, class Encoding>
+struct MsgField {
+    static void encode(const S& msg, ByteWriter& writer) {
+        Encoding::encode(msg.*Member, writer);
+    }
+    static bool decode(ByteReader& reader, S& msg) {
+        return Encoding::decode(reader, msg.*Member);
+    }
+    static bool assign(const QVariant& value, S& msg) {
+        if(!value.canConvert<T>()) return false;
+        msg.*Member = value.value<T>();
+        return true;
+    }
+};
+
+#define MSG_FIELD(Struct, member, Encoding) MsgField<Struct, decltype(Struct::member), &Struct::member, Encoding>
+
+template<class S, class... Fields>
+struct MsgFieldList;
+
+template<class S>
+struct MsgFieldList<S> {
+    static void encode(const S&, ByteWriter&) {}
+    static bool decode(ByteReader&, S&) {
+        return true;
+    }
+    static bool assign(QLinkedList<QVariant>::const_iterator, QLinkedList<QVariant>::const_iterator, S&) {
+        return true;
+    }
+};
+
+template<class S, class Field, class... Rest>
+struct MsgFieldList<S, Field, Rest...> {
+    static void encode(const S& msg, ByteWriter& writer) {
+        Field::encode(msg, writer);
+        MsgFieldList<S, Rest...>::encode(msg, writer);
+    }
+    static bool decode(ByteReader& reader, S& msg) {
+        return Field::decode(reader, msg) && MsgFieldList<S, Rest...>::decode(reader, msg);
+    }
+    static bool assign(QLinkedList<QVariant>::const_iterator iter, QLinkedList<QVariant>::const_iterator end, S& msg) {
+        if(iter == end || !Field::assign(*iter, msg)) return false;
+        return MsgFieldList<S, Rest...>::assign(++iter, end, msg);
+    }
+};
+
+/*Message layout fixed at compile time: fields are written one after another in declaration order without tags,
+ * encode and decode work straight on struct members and expand into straight line code. Example:
+ *     struct Heartbeat { quint64 node_id; qint32 load; QString state; };
+ *     typedef MsgSchema<Heartbeat, MSG_FIELD(Heartbeat, node_id, VarintEncoding),
+ *                       MSG_FIELD(Heartbeat, load, ZigZagEncoding), MSG_FIELD(Heartbeat, state, Utf8Encoding)> HeartbeatSchema;*/
+template<class S, class... Fields>
+struct MsgSchema {
+    typedef S Struct;
+    enum { FieldCount = sizeof...(Fields) };
+
+    /*Appends encoded message to out*/
+    static void encode(const S& msg, QByteArray& out) {
+        ByteWriter writer(out);
+        MsgFieldList<S, Fields...>::encode(msg, writer);
+    }
+    /*Returns count of consumed bytes, -1 when data is truncated or some value is out of range*/
+    static int decode(const char* data, const int size, S& msg) {
+        ByteReader reader(data, size);
+        if(!MsgFieldList<S, Fields...>::decode(reader, msg)) return -1;
+        return size - reader.remaining();
+    }
+    /*Legacy path for QVariant values given in field order*/
+    static bool assign(const QLinkedList<QVariant>& values, S& msg) {
+        if(values.size() != FieldCount) return false;
+        return MsgFieldList<S, Fields...>::assign(values.constBegin(), values.constEnd(), msg);
+    }
+};
+
+/*IMsgPacket keeping its fields in plain struct described by Schema*/
+template<class Schema>
+class SchemaMsgPacket : public IMsgPacket {
+public:
+    SchemaMsgPacket() : fields() {}
+    SchemaMsgPacket(const typename Schema::Struct& fields_) : fields(fields_) {}
+    virtual ~SchemaMsgPacket() {}
+
+    virtual QByteArray get_msg() {
+        QByteArray msg;
+        Schema::encode(fields, msg);
+        return msg;
+    }
+    /*Fields are left untouched when arguments do not match schema*/
+    virtual void set_msg_fields_values(const QLinkedList<QVariant>& args) {
+        typename Schema::Struct assigned(fields);
+        if(!Schema::assign(args, assigned)) {
+            qDebug() << "Message field values do not match schema, " << args.size() << " values given";
+            return;
+        }
+        fields = assigned;
+    }
+    int set_msg(const char* data, const int size) {
+        return Schema::decode(data, size, fields);
+    }
+    typename Schema::Struct fields;
+};
+
+#endif // MSGCODEC_H
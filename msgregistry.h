@@ -0,0 +1,170 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef MSGREGISTRY_H
+#define MSGREGISTRY_H
+#pragma once
+#include <QtCore>
+
+#include "IProtocol.h"
+
+#define MSG_TYPE_HASH_BASIS 2166136261u
+#define MSG_TYPE_HASH_PRIME 16777619u
+#define MSG_TYPE_HASH_MULTIPLIER 0x9E3779B1u
+/*Table is grown up to this many slots per registered type trying to get every type into its own slot*/
+#define MAX_MSG_TABLE_SPREAD 8
+
+/*Stable message type id, FNV-1a of type name, evaluated by compiler for string literals:
+ *     case msg_type_id("Heartbeat"): ...*/
+constexpr quint32 msg_type_id(const char* name, const quint32 hash = MSG_TYPE_HASH_BASIS) {
+    return *name ? msg_type_id(name + 1, (hash ^ quint32(uchar(*name))) * MSG_TYPE_HASH_PRIME) : hash;
+}
+
+inline quint32 msg_type_id(const QByteArray& name) {
+    quint32 hash = MSG_TYPE_HASH_BASIS;
+    for(int i = 0; i < name.size(); ++i) {
+        hash = (hash ^ quint32(uchar(name.at(i)))) * MSG_TYPE_HASH_PRIME;
+    }
+    return hash;
+}
+
+inline quint32 msg_type_id(const QString& name) {
+    return msg_type_id(name.toUtf8());
+}
+
+typedef bool (*MsgBuilder)(IMsgPacket& msg_packet);
+
+/*Dispatch of message types by integer id through open addressed table sized so that registered ids
+ * mostly land in distinct slots, lookup is one multiply, shift and compare. Types are registered
+ * at startup, after that lookups are read only and may run from any thread*/
+class MsgTypeRegistry : public IMsgFactory {
+    struct Entry {
+        Entry() : type_id(0), builder(NULL) {}
+        quint32 type_id;
+        MsgBuilder builder;
+    };
+public:
+    MsgTypeRegistry() : shift(32), mask(0) {}
+    virtual ~MsgTypeRegistry() {}
+
+    /*Fails on second registration of type and on name hash collision, the latter needs type rename
+     * since ids have to stay stable across nodes*/
+    bool register_type(const QString& msg_type, MsgBuilder builder) {
+        if(builder == NULL) return false;
+        quint32 type_id = msg_type_id(msg_type);
+        if(names.contains(type_id)) return false;
+        names.insert(type_id, msg_type);
+        builders.insert(type_id, builder);
+        rebuild();
+        return true;
+    }
+    bool unregister_type(const QString& msg_type) {
+        quint32 type_id = msg_type_id(msg_type);
+        if(names.value(type_id) != msg_type) return false;
+        names.remove(type_id);
+        builders.remove(type_id);
+        rebuild();
+        return true;
+    }
+    bool is_registered(const quint32 type_id) const {
+        return find(type_id) != NULL;
+    }
+    /*Hot path*/
+    bool create_msg(const quint32 type_id, IMsgPacket& msg_packet) const {
+        const Entry* entry = find(type_id);
+        if(entry == NULL) return false;
+        return entry->builder(msg_packet);
+    }
+    /*String fallback, hashes name on every call*/
+    virtual bool create_msg(const QString& msg_type, IMsgPacket& msg_packet) {
+        quint32 type_id = msg_type_id(msg_type);
+        if(names.value(type_id) != msg_type) return false;
+        return create_msg(type_id, msg_packet);
+    }
+    QString get_type_name(const quint32 type_id) const {
+        return names.value(type_id);
+    }
+    int get_type_count() const {
+        return names.size();
+    }
+    /*Count of types which do not sit in their home slot*/
+    int get_collision_count() const {
+        int collisions = 0;
+        for(int i = 0; i < table.size(); ++i) {
+            if(table[i].builder != NULL && slot_of(table[i].type_id) != i) ++collisions;
+        }
+        return collisions;
+    }
+private:
+    int slot_of(const quint32 type_id) const {
+        if(shift == 32) return 0;
+        return int((type_id * MSG_TYPE_HASH_MULTIPLIER) >> shift);
+    }
+    const Entry* find(const quint32 type_id) const {
+        if(table.isEmpty()) return NULL;
+        const Entry* entries = table.constData();
+        for(int slot = slot_of(type_id); entries[slot].builder != NULL; slot = (slot + 1) & mask) {
+            if(entries[slot].type_id == type_id) return entries + slot;
+        }
+        return NULL;
+    }
+    /*Starts from twice the type count so table never fills up, doubles while some ids share home slot*/
+    void rebuild() {
+        table.clear();
+        if(names.isEmpty()) {
+            shift = 32;
+            mask = 0;
+            return;
+        }
+        int bits = 1;
+        while((1 << bits) < 2 * names.size()) ++bits;
+        for(;; ++bits) {
+            if(place_all(bits)) break;
+            if((1 << (bits + 1)) > MAX_MSG_TABLE_SPREAD * names.size()) {
+                place_all(bits);
+                break;
+            }
+        }
+        table.squeeze();
+    }
+    /*Fills table of 2^bits slots, returns false when some entry had to be probed past its home slot*/
+    bool place_all(const int bits) {
+        shift = 32 - bits;
+        mask = (1 << bits) - 1;
+        table.fill(Entry(), 1 << bits);
+        bool perfect = true;
+        for(QHash<quint32, MsgBuilder>::const_iterator iter = builders.constBegin(); iter != builders.constEnd(); ++iter) {
+            int slot = slot_of(iter.key());
+            while(table[slot].builder != NULL) {
+                slot = (slot + 1) & mask;
+                perfect = false;
+            }
+            table[slot].type_id = iter.key();
+            table[slot].builder = iter.value();
+        }
+        return perfect;
+    }
+
+    int shift;
+    int mask;
+    QVector<Entry> table;
+    QHash<quint32, QString> names;
+    QHash<quint32, MsgBuilder> builders;
+};
+
+#endif // MSGREGISTRY_H
@@ -0,0 +1,190 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+#pragma once
+#include <QtNetwork>
+
+#include <atomic>
+#include <chrono>
+
+#define RATE_LIMIT_SHARD_COUNT 16
+#define RATE_LIMIT_PURGE_PERIOD 1024
+#define DEFAULT_IPV4_SUBNET_PREFIX 24
+#define DEFAULT_IPV6_SUBNET_PREFIX 64
+
+/*Bucket refills lazily on access, so idle buckets cost nothing*/
+struct TokenBucket {
+    TokenBucket(const double tokens_ = 0.0, const qint64 last_ns_ = 0) : tokens(tokens_), last_ns(last_ns_) {}
+
+    bool try_take(const double rate, const double burst, const qint64 now_ns) {
+        refill(rate, burst, now_ns);
+        if(tokens < 1.0) return false;
+        tokens -= 1.0;
+        return true;
+    }
+    void refill(const double rate, const double burst, const qint64 now_ns) {
+        tokens = qMin(burst, tokens + rate * (now_ns - last_ns) / 1e9);
+        last_ns = now_ns;
+    }
+    double tokens;
+    qint64 last_ns;
+};
+
+/*Token bucket limits per peer address and per subnet of peer (/24 for IPv4 and /64 for IPv6 by default).
+ * Request passes only when both buckets have token. Buckets are spread over mutex protected shards by subnet,
+ * so peer and its subnet are checked under one lock and connections of different threads rarely meet.
+ * Rate 0 disables corresponding limit, disabled limiter costs one atomic load*/
+class RateLimiter {
+    struct AddressKey {
+        AddressKey(const quint64 high_ = 0, const quint64 low_ = 0) : high(high_), low(low_) {}
+
+        bool operator == (const AddressKey& other) const {
+            return high == other.high && low == other.low;
+        }
+        quint64 high;
+        quint64 low;
+    };
+    friend uint qHash(const AddressKey& key, uint seed);
+    struct Shard {
+        Shard() : operations(0) {}
+
+        QMutex lock;
+        QHash<AddressKey, TokenBucket> peers;
+        QHash<AddressKey, TokenBucket> subnets;
+        quint32 operations;
+    };
+public:
+    RateLimiter() : enabled(false), peer_rate(0.0), peer_burst(0.0), subnet_rate(0.0), subnet_burst(0.0),
+                    ipv4_prefix(DEFAULT_IPV4_SUBNET_PREFIX), ipv6_prefix(DEFAULT_IPV6_SUBNET_PREFIX), rejected_count(0) {}
+    virtual ~RateLimiter() {}
+
+    /*Rates are in requests per second, burst is bucket capacity*/
+    void configure(const double peer_rate_, const double peer_burst_, const double subnet_rate_ = 0.0, const double subnet_burst_ = 0.0,
+                   const int ipv4_prefix_ = DEFAULT_IPV4_SUBNET_PREFIX, const int ipv6_prefix_ = DEFAULT_IPV6_SUBNET_PREFIX) {
+        for(int i = 0; i < RATE_LIMIT_SHARD_COUNT; ++i) {
+            shards[i].lock.lock();
+        }
+        peer_rate = qMax(0.0, peer_rate_);
+        peer_burst = qMax(1.0, peer_burst_);
+        subnet_rate = qMax(0.0, subnet_rate_);
+        subnet_burst = qMax(1.0, subnet_burst_);
+        ipv4_prefix = qBound(0, ipv4_prefix_, 32);
+        ipv6_prefix = qBound(0, ipv6_prefix_, 128);
+        for(int i = 0; i < RATE_LIMIT_SHARD_COUNT; ++i) {
+            shards[i].peers.clear();
+            shards[i].subnets.clear();
+            shards[i].lock.unlock();
+        }
+        enabled = peer_rate > 0.0 || subnet_rate > 0.0;
+    }
+    bool is_enabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+    /*Take one token for request of peer, false when request has to be rejected*/
+    bool allow(const QHostAddress& address) {
+        if(!enabled.load(std::memory_order_relaxed)) return true;
+        AddressKey peer_key;
+        AddressKey subnet_key;
+        make_keys(address, peer_key, subnet_key);
+        qint64 now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        Shard& shard = shards[qHash(subnet_key, 0) % RATE_LIMIT_SHARD_COUNT];
+        QMutexLocker locker(&shard.lock);
+        if(++shard.operations % RATE_LIMIT_PURGE_PERIOD == 0) purge(shard, now_ns);
+        TokenBucket* peer_bucket = NULL;
+        if(peer_rate > 0.0) {
+            peer_bucket = &bucket(shard.peers, peer_key, peer_burst, now_ns);
+            peer_bucket->refill(peer_rate, peer_burst, now_ns);
+            if(peer_bucket->tokens < 1.0) return reject();
+        }
+        if(subnet_rate > 0.0 && !bucket(shard.subnets, subnet_key, subnet_burst, now_ns).try_take(subnet_rate, subnet_burst, now_ns)) return reject();
+        if(peer_bucket != NULL) peer_bucket->tokens -= 1.0;
+        return true;
+    }
+    /*Time after which rejected peer may get next token*/
+    int get_retry_delay() const {
+        double rate = peer_rate > 0.0 ? peer_rate : subnet_rate;
+        return rate > 0.0 ? qMax(1, int(1000.0 / rate + 0.5)) : 0;
+    }
+    quint64 get_rejected_count() const {
+        return rejected_count.load(std::memory_order_relaxed);
+    }
+private:
+    bool reject() {
+        rejected_count.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    TokenBucket& bucket(QHash<AddressKey, TokenBucket>& buckets, const AddressKey& key, const double burst, const qint64 now_ns) {
+        QHash<AddressKey, TokenBucket>::iterator iter = buckets.find(key);
+        if(iter == buckets.end()) iter = buckets.insert(key, TokenBucket(burst, now_ns));
+        return iter.value();
+    }
+    /*Buckets which would be full again carry no state and are dropped*/
+    void purge(Shard& shard, const qint64 now_ns) {
+        purge(shard.peers, peer_rate, peer_burst, now_ns);
+        purge(shard.subnets, subnet_rate, subnet_burst, now_ns);
+    }
+    void purge(QHash<AddressKey, TokenBucket>& buckets, const double rate, const double burst, const qint64 now_ns) {
+        QHash<AddressKey, TokenBucket>::iterator iter = buckets.begin();
+        while(iter != buckets.end()) {
+            iter.value().refill(rate, burst, now_ns);
+            if(iter.value().tokens >= burst)
+                iter = buckets.erase(iter);
+            else
+                ++iter;
+        }
+    }
+    /*IPv4 mapped IPv6 addresses share keys with plain IPv4 ones*/
+    void make_keys(const QHostAddress& address, AddressKey& peer_key, AddressKey& subnet_key) const {
+        bool is_ipv4 = false;
+        quint32 ipv4 = address.toIPv4Address(&is_ipv4);
+        if(is_ipv4) {
+            peer_key = AddressKey(0, Q_UINT64_C(0x100000000) | ipv4);
+            quint32 mask = ipv4_prefix == 0 ? 0 : ~quint32(0) << (32 - ipv4_prefix);
+            subnet_key = AddressKey(0, Q_UINT64_C(0x100000000) | (ipv4 & mask));
+            return;
+        }
+        Q_IPV6ADDR ipv6 = address.toIPv6Address();
+        quint64 high = qFromBigEndian<quint64>(reinterpret_cast<const uchar*>(&ipv6));
+        quint64 low = qFromBigEndian<quint64>(reinterpret_cast<const uchar*>(&ipv6) + 8);
+        peer_key = AddressKey(high, low);
+        if(ipv6_prefix <= 64) {
+            subnet_key = AddressKey(ipv6_prefix == 0 ? 0 : high & (~Q_UINT64_C(0) << (64 - ipv6_prefix)), 0);
+        }
+        else {
+            subnet_key = AddressKey(high, ipv6_prefix == 128 ? low : low & (~Q_UINT64_C(0) << (128 - ipv6_prefix)));
+        }
+    }
+
+    std::atomic<bool> enabled;
+    double peer_rate;
+    double peer_burst;
+    double subnet_rate;
+    double subnet_burst;
+    int ipv4_prefix;
+    int ipv6_prefix;
+    std::atomic<quint64> rejected_count;
+    Shard shards[RATE_LIMIT_SHARD_COUNT];
+};
+
+inline uint qHash(const RateLimiter::AddressKey& key, uint seed) {
+    return qHash(key.high, seed) ^ qHash(key.low * Q_UINT64_C(0x9E3779B97F4A7C15), seed);
+}
+
+#endif // RATELIMITER_H
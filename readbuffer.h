@@ -0,0 +1,91 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef READBUFFER_H
+#define READBUFFER_H
+#pragma once
+#include <QtCore>
+
+#include <cstring>
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+#define DEFAULT_READ_BUFFER_SIZE 65536
+
+/*Connection owned receive buffer. Data is read from device into reserved space once per readyRead,
+ * parsers get borrowed pointers into it and consumed bytes are dropped by moving begin index,
+ * unconsumed tail is compacted to the front only when more space is needed. Memory is taken on first
+ * fill, so connections which never use buffered parsing do not pay for it*/
+class ReadBuffer {
+public:
+    ReadBuffer(const int capacity = DEFAULT_READ_BUFFER_SIZE) : initial_capacity(capacity), begin(0), end(0) {}
+    virtual ~ReadBuffer() {}
+
+    void reset() {
+        begin = end = 0;
+    }
+    const char* data() const {
+        return buffer.constData() + begin;
+    }
+    qint64 size() const {
+        return end - begin;
+    }
+    bool isEmpty() const {
+        return begin == end;
+    }
+    void consume(const qint64 count) {
+        begin += qMin(count, size());
+        if(begin == end) begin = end = 0;
+    }
+    void reserve(const qint64 count) {
+        if(buffer.size() - end >= count) return;
+        if(begin > 0) {
+            memmove(buffer.data(), buffer.constData() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+        if(buffer.size() - end < count) buffer.resize(qMax<qint64>(qMax<qint64>(2 * buffer.size(), initial_capacity), end + count));
+    }
+    /*Append everything available in device to unconsumed tail, returns count of bytes read*/
+    qint64 fill_from(QIODevice* device) {
+        qint64 available = device->bytesAvailable();
+        if(available <= 0) return 0;
+        reserve(available);
+        qint64 bytes_read = device->read(buffer.data() + end, available);
+        if(bytes_read > 0) end += bytes_read;
+        return bytes_read;
+    }
+#ifdef Q_OS_UNIX
+    /*Single read(2) from non blocking descriptor into free space of at least min_space bytes,
+     * returns result of read, so caller loops until -1 with EAGAIN*/
+    qint64 fill_from(const int descriptor, const qint64 min_space = DEFAULT_READ_BUFFER_SIZE / 4) {
+        reserve(min_space);
+        ssize_t bytes_read = ::read(descriptor, buffer.data() + end, buffer.size() - end);
+        if(bytes_read > 0) end += bytes_read;
+        return bytes_read;
+    }
+#endif
+private:
+    QByteArray buffer;
+    int initial_capacity;
+    qint64 begin;
+    qint64 end;
+};
+
+#endif // READBUFFER_H
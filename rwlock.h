@@ -0,0 +1,234 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef RWLOCK_H
+#define RWLOCK_H
+#pragma once
+#include <QtCore>
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <type_traits>
+
+#ifdef Q_OS_LINUX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define LOCK_SPIN_COUNT 64
+#define LOCK_WAIT_FOREVER -1
+#define SEQLOCK_READ_ATTEMPTS 8
+
+/*Parks thread while word still holds expected value, returns false once timeout_ns ran out.
+ * Other systems have no futex, there thread only yields and the caller keeps rechecking*/
+inline bool park_on_word(std::atomic<quint32>* word, const quint32 expected, const qint64 timeout_ns) {
+#ifdef Q_OS_LINUX
+    struct timespec timeout;
+    struct timespec* timeout_ptr = NULL;
+    if(timeout_ns >= 0) {
+        timeout.tv_sec = time_t(timeout_ns / 1000000000);
+        timeout.tv_nsec = long(timeout_ns % 1000000000);
+        timeout_ptr = &timeout;
+    }
+    long result = syscall(SYS_futex, reinterpret_cast<quint32*>(word), FUTEX_WAIT_PRIVATE, expected, timeout_ptr, NULL, 0);
+    return result == 0 || errno != ETIMEDOUT;
+#else
+    Q_UNUSED(word);
+    Q_UNUSED(expected);
+    Q_UNUSED(timeout_ns);
+    std::this_thread::yield();
+    return true;
+#endif
+}
+
+inline void wake_word(std::atomic<quint32>* word) {
+#ifdef Q_OS_LINUX
+    syscall(SYS_futex, reinterpret_cast<quint32*>(word), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+    Q_UNUSED(word);
+#endif
+}
+
+inline qint64 monotonic_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return qint64(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+/*Reader/writer lock with writer preference: new readers wait while a writer holds or waits for the lock.
+ * Lock bit, count of waiting writers and count of readers share one state word, so preference can not be
+ * lost between them. Contended threads spin shortly and then park on the state word, unlock wakes them
+ * only if someone sleeps.
+ * timeout_ms == 0 only tries, LOCK_WAIT_FOREVER blocks until lock is taken.
+ * Every write section also moves sequence counter, so small trivially copyable data can be read
+ * optimistically with read_begin/read_retry without touching the lock, readers meeting write in progress
+ * park on sequence word the same way*/
+class RWLock {
+    enum {
+        WriterLocked = 0x80000000u,
+        WaiterUnit = 0x00100000u,
+        WaiterMask = 0x7FF00000u,
+        ReaderMask = 0x000FFFFFu
+    };
+public:
+    RWLock() : state(0), sleepers(0), sequence(0), sequence_sleepers(0) {}
+    ~RWLock() {}
+
+    bool add_writer(const int timeout_ms = 0) {
+        quint32 current = 0;
+        if(state.compare_exchange_strong(current, WriterLocked, std::memory_order_acquire)) return locked_for_write();
+        if(timeout_ms == 0) return false;
+        add_waiting_writer();
+        /*Waiting writer leaves count in the same exchange which takes the lock*/
+        if(wait_for(timeout_ms, true)) return locked_for_write();
+        quint32 previous = state.fetch_sub(WaiterUnit);
+        /*Last waiting writer gave up, readers held back by preference may go on*/
+        if((previous & WaiterMask) == WaiterUnit) wake();
+        return false;
+    }
+    bool add_reader(const int timeout_ms = 0) {
+        if(try_add_reader()) return true;
+        if(timeout_ms == 0) return false;
+        return wait_for(timeout_ms, false);
+    }
+    bool release_writer() {
+        if((state.load(std::memory_order_relaxed) & WriterLocked) == 0) return false;
+        sequence.fetch_add(1);
+        if(sequence_sleepers.load() > 0) wake_word(&sequence);
+        state.fetch_and(~quint32(WriterLocked));
+        wake();
+        return true;
+    }
+    /*Returns count of remaining readers, -1 when no reader held the lock*/
+    int release_reader() {
+        quint32 current = state.load(std::memory_order_relaxed);
+        do {
+            if((current & ReaderMask) == 0) return -1;
+        } while(!state.compare_exchange_weak(current, current - 1));
+        int remaining = int((current & ReaderMask) - 1);
+        if(remaining == 0) wake();
+        return remaining;
+    }
+    bool is_writer() const {
+        return (state.load(std::memory_order_relaxed) & WriterLocked) != 0;
+    }
+    int count_read() const {
+        return int(state.load(std::memory_order_relaxed) & ReaderMask);
+    }
+    /*Seqlock side: odd sequence means write in progress*/
+    quint32 read_begin() const {
+        quint32 seq = sequence.load(std::memory_order_acquire);
+        for(int spin = 0; (seq & 1) != 0 && spin < LOCK_SPIN_COUNT; ++spin) {
+            seq = sequence.load(std::memory_order_acquire);
+        }
+        while(seq & 1) {
+            sequence_sleepers.fetch_add(1);
+            park_on_word(&sequence, seq, LOCK_WAIT_FOREVER);
+            sequence_sleepers.fetch_sub(1);
+            seq = sequence.load(std::memory_order_acquire);
+        }
+        return seq;
+    }
+    bool read_retry(const quint32 seq) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return sequence.load(std::memory_order_relaxed) != seq;
+    }
+    /*Optimistic copy of value guarded by this lock, falls back to shared lock when writers keep interfering*/
+    template<class V>
+    void read_snapshot(const V* source, V& copy) {
+        static_assert(std::is_trivially_copyable<V>::value, "seqlock read needs trivially copyable data");
+        for(int attempt = 0; attempt < SEQLOCK_READ_ATTEMPTS; ++attempt) {
+            quint32 seq = read_begin();
+            memcpy(&copy, source, sizeof(V));
+            if(!read_retry(seq)) return;
+        }
+        add_reader(LOCK_WAIT_FOREVER);
+        memcpy(&copy, source, sizeof(V));
+        release_reader();
+    }
+private:
+    bool locked_for_write() {
+        sequence.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return true;
+    }
+    void add_waiting_writer() {
+        quint32 current = state.load(std::memory_order_relaxed);
+        for(;;) {
+            if((current & WaiterMask) == WaiterMask) {
+                std::this_thread::yield();
+                current = state.load(std::memory_order_relaxed);
+                continue;
+            }
+            if(state.compare_exchange_weak(current, current + WaiterUnit)) return;
+        }
+    }
+    bool try_add_reader() {
+        quint32 current = state.load(std::memory_order_relaxed);
+        while((current & (WriterLocked | WaiterMask)) == 0 && (current & ReaderMask) != ReaderMask) {
+            if(state.compare_exchange_weak(current, current + 1, std::memory_order_acquire)) return true;
+        }
+        return false;
+    }
+    /*Taken by waiting writer, so its count is dropped together with setting lock bit*/
+    bool try_take_writer() {
+        quint32 current = state.load(std::memory_order_relaxed);
+        while((current & (WriterLocked | ReaderMask)) == 0) {
+            if(state.compare_exchange_weak(current, (current - WaiterUnit) | WriterLocked, std::memory_order_acquire)) return true;
+        }
+        return false;
+    }
+    bool try_take(const bool as_writer) {
+        return as_writer ? try_take_writer() : try_add_reader();
+    }
+    bool wait_for(const int timeout_ms, const bool as_writer) {
+        qint64 deadline = timeout_ms < 0 ? -1 : monotonic_now_ns() + qint64(timeout_ms) * 1000000;
+        for(int spin = 0; spin < LOCK_SPIN_COUNT; ++spin) {
+            if(try_take(as_writer)) return true;
+        }
+        for(;;) {
+            sleepers.fetch_add(1);
+            quint32 observed = state.load();
+            bool blocked = as_writer ? (observed & (WriterLocked | ReaderMask)) != 0 : (observed & (WriterLocked | WaiterMask)) != 0;
+            bool in_time = true;
+            if(blocked) {
+                qint64 left = -1;
+                if(deadline >= 0) left = qMax(deadline - monotonic_now_ns(), qint64(0));
+                in_time = left != 0 && park_on_word(&state, observed, left);
+            }
+            sleepers.fetch_sub(1);
+            if(try_take(as_writer)) return true;
+            if(!in_time || (deadline >= 0 && monotonic_now_ns() >= deadline)) return false;
+        }
+    }
+    void wake() {
+        if(sleepers.load() > 0) wake_word(&state);
+    }
+
+    std::atomic<quint32> state;
+    std::atomic<int> sleepers;
+    mutable std::atomic<quint32> sequence;
+    mutable std::atomic<int> sequence_sleepers;
+};
+
+#endif // RWLOCK_H
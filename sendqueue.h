@@ -0,0 +1,212 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef SENDQUEUE_H
+#define SENDQUEUE_H
+#pragma once
+#include <QtNetwork>
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#define DEFAULT_COALESCE_LIMIT 65536
+#define MAX_IOV_COUNT 64
+#define DEFAULT_HIGH_WATERMARK 4194304
+#define DEFAULT_LOW_WATERMARK 1048576
+
+/*Per connection queue of outbound messages. Messages are kept as implicitly shared chunks until flush,
+ * flush hands all of them to socket at once and completion of every message is tracked by its end offset
+ * in outbound byte stream*/
+class OutboundQueue {
+    struct MsgDesc {
+        quint64 msg_id;
+        qint64 end_offset;
+    };
+public:
+    OutboundQueue() : next_msg_id(1), pending_bytes(0), enqueued_offset(0), written_offset(0) {}
+    virtual ~OutboundQueue() {
+        reset();
+    }
+
+    void reset() {
+        pending_chunks.clear();
+        messages.clear();
+        pending_bytes = 0;
+        enqueued_offset = written_offset = 0;
+    }
+    /*Message may consist of several chunks (e.g. frame header and payload), id is assigned to whole message*/
+    quint64 enqueue(const QByteArray& chunk) {
+        return enqueue(&chunk, 1);
+    }
+    quint64 enqueue(const QByteArray* chunks, const int count) {
+        for(int i = 0; i < count; ++i) {
+            if(chunks[i].isEmpty()) continue;
+            pending_chunks.append(chunks[i]);
+            pending_bytes += chunks[i].size();
+            enqueued_offset += chunks[i].size();
+        }
+        MsgDesc desc;
+        desc.msg_id = next_msg_id++;
+        desc.end_offset = enqueued_offset;
+        messages.enqueue(desc);
+        return desc.msg_id;
+    }
+    bool hasPending() const {
+        return !pending_chunks.isEmpty();
+    }
+    qint64 get_pending_bytes() const {
+        return pending_bytes;
+    }
+    /*Bytes handed to socket but not yet reported as written plus bytes still waiting for flush*/
+    qint64 get_unsent_bytes() const {
+        return enqueued_offset - written_offset;
+    }
+    /*Write all pending chunks in one go. For plain sockets with empty write buffer chunks go straight to
+     * descriptor with one vectored sendmsg, whatever is left is gathered into single buffer for socket.
+     * Returns count of bytes written directly to descriptor, they are never reported by bytesWritten,
+     * -1 when socket refused data, pending chunks are dropped then since connection is unusable*/
+    qint64 flush(QTcpSocket* socket, const bool allow_vectored = true) {
+        if(pending_chunks.isEmpty()) return 0;
+        qint64 direct_written = 0;
+        qint64 result = 0;
+#ifdef Q_OS_UNIX
+        if(allow_vectored && socket->bytesToWrite() == 0 && socket->socketDescriptor() != -1) {
+            direct_written = write_vectored(socket->socketDescriptor());
+        }
+#endif
+        if(direct_written < 0) {
+            result = -1;
+        }
+        else if(pending_chunks.size() == 1 && direct_written == 0) {
+            result = socket->write(pending_chunks.first());
+        }
+        else if(direct_written < pending_bytes) {
+            QByteArray batch;
+            batch.reserve(pending_bytes - direct_written);
+            qint64 skip = direct_written;
+            foreach(const QByteArray& chunk, pending_chunks) {
+                if(skip >= chunk.size()) {
+                    skip -= chunk.size();
+                    continue;
+                }
+                batch.append(chunk.constData() + skip, chunk.size() - skip);
+                skip = 0;
+            }
+            result = socket->write(batch);
+        }
+        pending_chunks.clear();
+        pending_bytes = 0;
+        return result < 0 ? -1 : direct_written;
+    }
+    /*Message without bytes is complete as soon as everything queued before it is written*/
+    bool has_completed() const {
+        return !messages.isEmpty() && messages.head().end_offset <= written_offset;
+    }
+    /*Account written bytes and collect ids of messages which were written completely*/
+    void on_bytes_written(const qint64 bytes, QList<quint64>& completed) {
+        written_offset += bytes;
+        while(!messages.isEmpty() && messages.head().end_offset <= written_offset) {
+            completed.append(messages.dequeue().msg_id);
+        }
+    }
+private:
+#ifdef Q_OS_UNIX
+    qint64 write_vectored(const qintptr descriptor) {
+        iovec iov[MAX_IOV_COUNT];
+        int count = qMin(pending_chunks.size(), MAX_IOV_COUNT);
+        for(int i = 0; i < count; ++i) {
+            iov[i].iov_base = const_cast<char*>(pending_chunks.at(i).constData());
+            iov[i].iov_len = pending_chunks.at(i).size();
+        }
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t result = ::sendmsg(descriptor, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(result < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        return result;
+    }
+#endif
+    quint64 next_msg_id;
+    qint64 pending_bytes;
+    qint64 enqueued_offset;
+    qint64 written_offset;
+    QVector<QByteArray> pending_chunks;
+    QQueue<MsgDesc> messages;
+};
+
+/*Backpressure state of connection outbound data: paused when unsent bytes reach high mark,
+ * resumed when they drop to low mark. Time spent paused is accumulated for monitoring*/
+class WriteWatermark {
+public:
+    WriteWatermark(const qint64 high_mark_ = DEFAULT_HIGH_WATERMARK, const qint64 low_mark_ = DEFAULT_LOW_WATERMARK) :
+        paused(false), pause_count(0), total_paused_ms(0) {
+        set_marks(high_mark_, low_mark_);
+    }
+    virtual ~WriteWatermark() {}
+
+    /*high_mark == 0 switches backpressure off*/
+    void set_marks(const qint64 high_mark_, const qint64 low_mark_) {
+        high_mark = high_mark_;
+        low_mark = qMin(low_mark_, high_mark_);
+    }
+    qint64 get_high_mark() const {
+        return high_mark;
+    }
+    qint64 get_low_mark() const {
+        return low_mark;
+    }
+    /*Returns 1 when high mark was crossed, -1 when low mark was reached, 0 if state is not changed*/
+    int update(const qint64 unsent_bytes) {
+        if(!paused && high_mark > 0 && unsent_bytes >= high_mark) {
+            paused = true;
+            ++pause_count;
+            pause_timer.start();
+            return 1;
+        }
+        if(paused && (high_mark == 0 || unsent_bytes <= low_mark)) {
+            paused = false;
+            total_paused_ms += pause_timer.elapsed();
+            return -1;
+        }
+        return 0;
+    }
+    bool is_paused() const {
+        return paused;
+    }
+    quint64 get_pause_count() const {
+        return pause_count;
+    }
+    qint64 get_time_over_mark() const {
+        return paused ? total_paused_ms + pause_timer.elapsed() : total_paused_ms;
+    }
+private:
+    bool paused;
+    qint64 high_mark;
+    qint64 low_mark;
+    quint64 pause_count;
+    qint64 total_paused_ms;
+    QElapsedTimer pause_timer;
+};
+
+#endif // SENDQUEUE_H
@@ -21,40 +21,248 @@ SOFTWARE.
 #pragma once
 #include <QtNetwork>
 
+#include <atomic>
+
+#ifdef Q_OS_WIN
+#include <winsock2.h>
+#else
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 #include "connection.h"
+#include "connregistry.h"
+#include "epolltransport.h"
+#include "metrics.h"
+#include "ratelimiter.h"
+#include "subnettrie.h"
+#include "timerwheel.h"
+
+/*Closes connections silent longer than idle timeout. Traffic only restarts connection clock,
+ * wheel timer is moved to remaining idle time when it fires, so busy connections cost nothing per message*/
+class IdleConnectionEvictor : public ITimerHandler {
+public:
+    IdleConnectionEvictor(TimerWheel* wheel_) : idle_timeout(0), wheel(wheel_) {}
+    virtual ~IdleConnectionEvictor() {
+        reset();
+    }
+
+    void reset() {
+        foreach(TimerWheel::TimerId timer_id, timers) {
+            wheel->cancel(timer_id);
+        }
+        timers.clear();
+        watched.clear();
+    }
+    /*0 disables eviction, already watched connections are re-armed with new timeout*/
+    void set_idle_timeout(const qint64 idle_timeout_) {
+        idle_timeout = idle_timeout_;
+        QHash<quint64, QPointer<TCPConnection> >::iterator iter = watched.begin();
+        while(iter != watched.end()) {
+            arm(iter.key());
+            ++iter;
+        }
+    }
+    qint64 get_idle_timeout() const {
+        return idle_timeout;
+    }
+    void watch(TCPConnection* conn) {
+        watched.insert(conn->get_conn_id(), QPointer<TCPConnection>(conn));
+        arm(conn->get_conn_id());
+    }
+    void unwatch(const quint64 conn_id) {
+        wheel->cancel(timers.take(conn_id));
+        watched.remove(conn_id);
+    }
+    virtual void on_timer_expired(const quint64 conn_id) {
+        timers.remove(conn_id);
+        QPointer<TCPConnection> conn = watched.value(conn_id);
+        if(conn.isNull()) {
+            watched.remove(conn_id);
+            return;
+        }
+        qint64 idle_time = conn->get_idle_time();
+        if(idle_time < idle_timeout) {
+            timers.insert(conn_id, wheel->arm(idle_timeout - idle_time, this, conn_id));
+            return;
+        }
+        qInfo() << "Close connection idle for " << idle_time << " ms: " << conn_id;
+        watched.remove(conn_id);
+        conn->close();
+    }
+private:
+    void arm(const quint64 conn_id) {
+        wheel->cancel(timers.take(conn_id));
+        if(idle_timeout > 0) timers.insert(conn_id, wheel->arm(idle_timeout, this, conn_id));
+    }
+
+    qint64 idle_timeout;
+    TimerWheel* wheel;
+    QHash<quint64, QPointer<TCPConnection> > watched;
+    QHash<quint64, TimerWheel::TimerId> timers;
+};
+
+/*Event loop serving subset of accepted connections, lives in its own thread*/
+class ServerWorker : public QObject {
+    Q_OBJECT
+public:
+    ServerWorker(QSharedPointer<ConnectionRegistry> registry_, QSharedPointer<MetricsAggregate> metrics_, QSharedPointer<RateLimiter> msg_limiter_,
+                 QObject* parent = NULL) : QObject(parent), load(0), registry(registry_), metrics(metrics_), msg_limiter(msg_limiter_),
+                                                                                      wheel(DEFAULT_TIMER_TICK, this), evictor(&wheel) {}
+    virtual ~ServerWorker() {
+        reset();
+    }
+
+    virtual void reset() {
+        evictor.reset();
+        /*Closing socket emits connection_closed synchronously, so connections are detached
+         * from onConnectionClosed and taken out of the set before deletion*/
+        QSet<TCPConnection*> closing;
+        closing.swap(connections);
+        foreach(TCPConnection* conn, closing) {
+            disconnect(conn, 0, this, 0);
+            registry->unregister_conn(conn->get_conn_id());
+            metrics->retire(conn->get_conn_id());
+        }
+        qDeleteAll(closing);
+        load = 0;
+    }
+    int get_load() const {
+        return load.load();
+    }
+public slots:
+    void accept_descriptor(qintptr socket_descriptor) {
+        QTcpSocket* socket = new QTcpSocket();
+        if(!socket->setSocketDescriptor(socket_descriptor)) {
+            qDebug() << "Worker failed to take socket: " << socket->errorString();
+            delete socket;
+            return;
+        }
+        TCPConnection* conn = new TCPConnection(socket, this);
+        conn->set_conn_id(registry->register_conn(conn, ConnectionKey(socket)));
+        conn->set_msg_rate_limiter(msg_limiter);
+        connect(conn, SIGNAL(connection_closed()), this, SLOT(onConnectionClosed()));
+        connections.insert(conn);
+        metrics->attach(conn->get_conn_id(), conn->get_metrics());
+        evictor.watch(conn);
+        ++load;
+    }
+    void set_idle_timeout(qint64 idle_timeout) {
+        evictor.set_idle_timeout(idle_timeout);
+    }
+private slots:
+    void onConnectionClosed() {
+        TCPConnection* conn = qobject_cast<TCPConnection*>(sender());
+        if(conn == NULL || !connections.remove(conn)) return;
+        evictor.unwatch(conn->get_conn_id());
+        registry->unregister_conn(conn->get_conn_id());
+        metrics->retire(conn->get_conn_id());
+        conn->deleteLater();
+        --load;
+    }
+private:
+    std::atomic<int> load;
+    QSharedPointer<ConnectionRegistry> registry;
+    QSharedPointer<MetricsAggregate> metrics;
+    QSharedPointer<RateLimiter> msg_limiter;
+    QSet<TCPConnection*> connections;
+    TimerWheel wheel;
+    IdleConnectionEvictor evictor;
+};
 
 class TCPServer : public QTcpServer {
     Q_OBJECT
 public:
-    TCPServer(const quint16 port = 8080, QObject* parent = 0) : QTcpServer(parent) {
+    enum DispatchPolicy {
+        RoundRobin = 0,
+        LeastLoaded
+    };
+    enum TransportBackend {
+        QtTransport = 0,
+        EpollTransport
+    };
+    TCPServer(const quint16 port = 8080, QObject* parent = 0) : QTcpServer(parent), registry(new ConnectionRegistry()), metrics(new MetricsAggregate()),
+                                                                msg_limiter(new RateLimiter()),
+                                                                dispatch_policy(RoundRobin), next_worker(0), idle_timeout(0),
+                                                                wheel(DEFAULT_TIMER_TICK, this), evictor(&wheel) {
         server_start(port);
     }
     virtual ~TCPServer() {
+        stop_epoll_loops();
+        stop_workers();
         reset();
         if(this->isListening()) this->close();
     }
 
     virtual void reset() {
-        if(!blocked_addresses.isEmpty()) blocked_addresses.clear();
-        QHash<QString, QSharedPointer<TCPConnection> >::iterator iter = active_connections.begin();
+        blocklist.reset();
+        evictor.reset();
+        QHash<quint64, QSharedPointer<TCPConnection> >::iterator iter = active_connections.begin();
         while(iter != active_connections.end()) {
+            registry->unregister_conn(iter.key());
+            metrics->retire(iter.key());
             iter.value().reset();
+            ++iter;
         }
         active_connections.clear();
     }
-    virtual void remove_conn(const QString conn_id) {
-        active_connections[conn_id].reset();
+    virtual void remove_conn(const quint64 conn_id) {
+        evictor.unwatch(conn_id);
+        registry->unregister_conn(conn_id);
+        metrics->retire(conn_id);
         active_connections.remove(conn_id);
     }
     virtual void add_blocked_address(QHostAddress& addr) {
-        blocked_addresses.append(addr);
+        blocklist.add(addr);
     }
     virtual int remove_blocked_address(QHostAddress& addr) {
-        return blocked_addresses.removeAll(addr);
+        return blocklist.remove(addr) ? 1 : 0;
+    }
+    /*Block whole subnet, e.g. "10.0.0.0/8" or "2001:db8::/32"*/
+    virtual bool add_blocked_subnet(const QString& subnet) {
+        return blocklist.add(subnet);
     }
-    QSharedPointer<TCPConnection> get_conn_ptr(const QString conn_id) const {
-        if(!active_connections.contains(conn_id)) return QSharedPointer<TCPConnection>(NULL);
-        return active_connections[conn_id];
+    virtual bool remove_blocked_subnet(const QString& subnet) {
+        return blocklist.remove(subnet);
+    }
+    bool is_blocked(const QHostAddress& addr) const {
+        return blocklist.contains(addr);
+    }
+    /*Connections per second allowed for one peer and for its subnet, 0 rate disables limit*/
+    void set_accept_rate_limit(const double peer_rate, const double peer_burst, const double subnet_rate = 0.0, const double subnet_burst = 0.0) {
+        accept_limiter.configure(peer_rate, peer_burst, subnet_rate, subnet_burst);
+    }
+    /*Parsed messages per second allowed for one peer and for its subnet over all their connections,
+     * limiter is shared by connections of all threads and takes effect immediately*/
+    void set_msg_rate_limit(const double peer_rate, const double peer_burst, const double subnet_rate = 0.0, const double subnet_burst = 0.0) {
+        msg_limiter->configure(peer_rate, peer_burst, subnet_rate, subnet_burst);
+    }
+    quint64 get_rejected_accept_count() const {
+        return accept_limiter.get_rejected_count();
+    }
+    quint64 get_rejected_msg_count() const {
+        return msg_limiter->get_rejected_count();
+    }
+    /*Connection owned by server thread*/
+    QSharedPointer<TCPConnection> get_conn_ptr(const quint64 conn_id) const {
+        return active_connections.value(conn_id);
+    }
+    /*Connection served by any thread, it has to be used in thread it belongs to*/
+    TCPConnection* find_conn(const quint64 conn_id) const {
+        return registry->find_conn(conn_id);
+    }
+    quint64 find_conn_id(const ConnectionKey& key) const {
+        return registry->find_conn_id(key);
+    }
+    /*Totals over live and closed connections of server and its workers, taken without stopping I/O*/
+    MetricsSnapshot get_metrics_snapshot() const {
+        return metrics->snapshot();
+    }
+    bool get_conn_metrics(const quint64 conn_id, MetricsSnapshot& snapshot) const {
+        return metrics->snapshot(conn_id, snapshot);
+    }
+    QList<quint64> get_metered_conn_ids() const {
+        return metrics->get_conn_ids();
     }
     void server_start(const quint16& port = 8080) {
         connect(this, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
@@ -66,20 +274,224 @@ public:
             qDebug()<< "Server failed to start at: " << start_time.toString(QString("MMM d, yyyy @ h:m:s.zzz ap"));
         }
     }
+    /*Spread accepted connections across worker_count threads each running its own event loop,
+     * worker_count == 0 returns server to single thread mode*/
+    bool start_workers(const int worker_count = QThread::idealThreadCount(), const DispatchPolicy policy = RoundRobin) {
+        stop_workers();
+        if(worker_count <= 0) return false;
+        qRegisterMetaType<qintptr>("qintptr");
+        dispatch_policy = policy;
+        for(int i = 0; i < worker_count; ++i) {
+            QThread* thread = new QThread(this);
+            ServerWorker* worker = new ServerWorker(registry, metrics, msg_limiter);
+            worker->set_idle_timeout(idle_timeout);
+            worker->moveToThread(thread);
+            connect(thread, SIGNAL(finished()), worker, SLOT(deleteLater()));
+            thread->start();
+            worker_threads.append(thread);
+            workers.append(worker);
+        }
+        qInfo() << "Server dispatches connections to " << worker_count << " worker threads";
+        return true;
+    }
+    void stop_workers() {
+        foreach(QThread* thread, worker_threads) {
+            thread->quit();
+            thread->wait();
+            delete thread;
+        }
+        worker_threads.clear();
+        workers.clear();
+        next_worker = 0;
+    }
+    int get_worker_count() const {
+        return workers.size();
+    }
+    /*Serve accepted connections by loop_count epoll threads instead of QTcpSocket, handler gets messages
+     * directly from loop threads. Has to be chosen at startup, connections already accepted stay on Qt transport*/
+    bool start_epoll_loops(const int loop_count, IEpollHandler* handler) {
+#ifdef Q_OS_LINUX
+        stop_epoll_loops();
+        if(loop_count <= 0 || handler == NULL) return false;
+        for(int i = 0; i < loop_count; ++i) {
+            EpollLoop* loop = new EpollLoop(handler, this);
+            if(!loop->is_valid()) {
+                delete loop;
+                stop_epoll_loops();
+                return false;
+            }
+            loop->start_loop();
+            epoll_loops.append(loop);
+        }
+        qInfo() << "Server serves connections by " << loop_count << " epoll loops";
+        /*Co-located peers dialing by EpollLoop find this socket by port and switch to it on their own,
+         * peers connecting by QTcpSocket stay on TCP loopback*/
+        if(local_listener.listen(local_socket_path(serverPort()))) {
+            connect(&local_listener, SIGNAL(descriptor_accepted(qintptr)), this, SLOT(onLocalDescriptor(qintptr)), Qt::UniqueConnection);
+        }
+        return true;
+#else
+        Q_UNUSED(loop_count);
+        Q_UNUSED(handler);
+        return false;
+#endif
+    }
+    void stop_epoll_loops() {
+#ifdef Q_OS_LINUX
+        local_listener.close();
+        qDeleteAll(epoll_loops);
+        epoll_loops.clear();
+#endif
+    }
+    TransportBackend get_transport_backend() const {
+#ifdef Q_OS_LINUX
+        if(!epoll_loops.isEmpty()) return EpollTransport;
+#endif
+        return QtTransport;
+    }
+    /*Close connections without traffic for idle_timeout ms, 0 disables eviction*/
+    void set_idle_timeout(const qint64 idle_timeout_) {
+        idle_timeout = idle_timeout_;
+        evictor.set_idle_timeout(idle_timeout);
+        foreach(ServerWorker* worker, workers) {
+            QMetaObject::invokeMethod(worker, "set_idle_timeout", Qt::QueuedConnection, Q_ARG(qint64, idle_timeout));
+        }
+    }
+    qint64 get_idle_timeout() const {
+        return idle_timeout;
+    }
+signals:
+    /*Connection accepted in server thread is ready, receivers may setup its parser before any data is read*/
+    void connection_accepted(quint64 conn_id);
 public slots:
     void onNewConnection() {
         if(!this->hasPendingConnections()) return;
         QTcpSocket* new_connection = this->nextPendingConnection();
-        if(!blocked_addresses.isEmpty() && blocked_addresses.contains(new_connection->peerAddress())) {
+        if(blocklist.contains(new_connection->peerAddress())) {
             qInfo() << "Refuse to establish connection with: " << new_connection->peerAddress().toString();
             new_connection->disconnectFromHost();
             return;
         }
-        active_connections.insert(new_connection->peerAddress().toString(), QSharedPointer<TCPConnection>(new TCPConnection(new_connection, this)));
+        QSharedPointer<TCPConnection> conn_ptr(new TCPConnection(new_connection, this), &QObject::deleteLater);
+        quint64 conn_id = registry->register_conn(conn_ptr.data(), ConnectionKey(new_connection));
+        conn_ptr->set_conn_id(conn_id);
+        conn_ptr->set_msg_rate_limiter(msg_limiter);
+        connect(conn_ptr.data(), SIGNAL(connection_closed()), this, SLOT(onConnectionClosed()));
+        active_connections.insert(conn_id, conn_ptr);
+        metrics->attach(conn_id, conn_ptr->get_metrics());
+        evictor.watch(conn_ptr.data());
+        emit connection_accepted(conn_id);
+    }
+private slots:
+    void onConnectionClosed() {
+        TCPConnection* conn = qobject_cast<TCPConnection*>(sender());
+        if(conn != NULL) remove_conn(conn->get_conn_id());
+    }
+    void onLocalDescriptor(qintptr socket_descriptor) {
+#ifdef Q_OS_LINUX
+        /*Unix socket peer has no address of its own, it is admitted as loopback peer*/
+        if(epoll_loops.isEmpty() || !admit_peer(QHostAddress(QHostAddress::LocalHost))) {
+            ::close(socket_descriptor);
+            return;
+        }
+        choose_epoll_loop()->adopt_descriptor(socket_descriptor, registry->reserve_conn_id());
+#else
+        Q_UNUSED(socket_descriptor);
+#endif
+    }
+protected:
+    /*In worker and epoll modes accepted descriptor is handed over before any QTcpSocket is created for it,
+     * blocked and over limit peers are refused right here in all modes*/
+    virtual void incomingConnection(qintptr socket_descriptor) {
+        bool dispatched = !workers.isEmpty();
+#ifdef Q_OS_LINUX
+        dispatched = dispatched || !epoll_loops.isEmpty();
+#endif
+        if(dispatched || accept_limiter.is_enabled()) {
+            QHostAddress peer_address;
+            if(!get_peer_address(socket_descriptor, peer_address) || !admit_peer(peer_address)) {
+                close_descriptor(socket_descriptor);
+                return;
+            }
+        }
+#ifdef Q_OS_LINUX
+        if(!epoll_loops.isEmpty()) {
+            choose_epoll_loop()->adopt_descriptor(socket_descriptor, registry->reserve_conn_id());
+            return;
+        }
+#endif
+        if(workers.isEmpty()) {
+            QTcpServer::incomingConnection(socket_descriptor);
+            return;
+        }
+        QMetaObject::invokeMethod(choose_worker(), "accept_descriptor", Qt::QueuedConnection, Q_ARG(qintptr, socket_descriptor));
+    }
+    /*Blocklist and accept rate limit*/
+    bool admit_peer(const QHostAddress& peer_address) {
+        if(blocklist.contains(peer_address)) {
+            qInfo() << "Refuse to establish connection with: " << peer_address.toString();
+            return false;
+        }
+        return accept_limiter.allow(peer_address);
+    }
+#ifdef Q_OS_LINUX
+    EpollLoop* choose_epoll_loop() const {
+        EpollLoop* loop = epoll_loops.first();
+        foreach(EpollLoop* candidate, epoll_loops) {
+            if(candidate->get_conn_count() < loop->get_conn_count()) loop = candidate;
+        }
+        return loop;
+    }
+#endif
+    ServerWorker* choose_worker() {
+        if(dispatch_policy == LeastLoaded) {
+            ServerWorker* best_worker = workers.first();
+            foreach(ServerWorker* worker, workers) {
+                if(worker->get_load() < best_worker->get_load()) best_worker = worker;
+            }
+            return best_worker;
+        }
+        next_worker = (next_worker + 1) % workers.size();
+        return workers.at(next_worker);
+    }
+    /*Peer of descriptor not yet wrapped by QTcpSocket*/
+    static bool get_peer_address(const qintptr socket_descriptor, QHostAddress& peer_address) {
+        sockaddr_storage addr;
+#ifdef Q_OS_WIN
+        int addr_len = sizeof(addr);
+        if(::getpeername(SOCKET(socket_descriptor), reinterpret_cast<sockaddr*>(&addr), &addr_len) != 0) return false;
+#else
+        socklen_t addr_len = sizeof(addr);
+        if(::getpeername(int(socket_descriptor), reinterpret_cast<sockaddr*>(&addr), &addr_len) != 0) return false;
+#endif
+        peer_address.setAddress(reinterpret_cast<const sockaddr*>(&addr));
+        return true;
+    }
+    static void close_descriptor(const qintptr socket_descriptor) {
+#ifdef Q_OS_WIN
+        ::closesocket(SOCKET(socket_descriptor));
+#else
+        ::close(int(socket_descriptor));
+#endif
     }
 private:
-    QList<QHostAddress> blocked_addresses;
-    QHash<QString, QSharedPointer<TCPConnection> > active_connections;
+    SubnetTrie blocklist;
+    RateLimiter accept_limiter;
+    QSharedPointer<ConnectionRegistry> registry;
+    QSharedPointer<MetricsAggregate> metrics;
+    QSharedPointer<RateLimiter> msg_limiter;
+    QHash<quint64, QSharedPointer<TCPConnection> > active_connections;
+    DispatchPolicy dispatch_policy;
+    int next_worker;
+    QList<QThread*> worker_threads;
+    QList<ServerWorker*> workers;
+#ifdef Q_OS_LINUX
+    QList<EpollLoop*> epoll_loops;
+    LocalListener local_listener;
+#endif
+    qint64 idle_timeout;
+    TimerWheel wheel;
+    IdleConnectionEvictor evictor;
 };
 
 #endif // SERVER_H
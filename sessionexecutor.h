@@ -0,0 +1,284 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef SESSIONEXECUTOR_H
+#define SESSIONEXECUTOR_H
+#pragma once
+#include <QtCore>
+
+#include "IProtocol.h"
+#include "timerwheel.h"
+
+#define MAX_SESSION_OUTPUT_BATCH 256
+
+struct SessionOutput {
+    SessionOutput() : session_id(0) {}
+    SessionOutput(const quint64 session_id_, const QByteArray& msg_) : session_id(session_id_), msg(msg_) {}
+    quint64 session_id;
+    QByteArray msg;
+};
+
+/*Receives results of sessions, called from executor threads so implementation has to be thread safe*/
+class ISessionSink {
+public:
+    virtual ~ISessionSink() {}
+
+    virtual void on_send_batch(const QVector<SessionOutput>& batch) = 0;
+    virtual void on_session_timeout(const quint64 session_id) = 0;
+    /*State machine rejected packet, session is already dropped from executor*/
+    virtual void on_session_failed(const quint64 session_id) = 0;
+};
+
+class SessionShard;
+
+class ManagedSession : public BaseProtocol {
+public:
+    ManagedSession(const quint64 session_id_, SessionShard* shard_) : session_id(session_id_), shard(shard_) {}
+    virtual ~ManagedSession() {}
+
+    quint64 get_session_id() const {
+        return session_id;
+    }
+protected:
+    virtual void on_session_timeout();
+private:
+    quint64 session_id;
+    SessionShard* shard;
+};
+
+/*Sessions of one thread: events are queued under mutex by any thread and drained in batches by shard's own thread,
+ * one queued wake up per batch. Deadlines of Ignore state run on shard's timer wheel*/
+class SessionShard : public QObject {
+    Q_OBJECT
+    struct Event {
+        enum Kind {
+            Open,
+            Packet,
+            Close
+        };
+        Event() : kind(Packet), session_id(0) {}
+        Kind kind;
+        quint64 session_id;
+        QSharedPointer<ISessionStates> states;
+        QSharedPointer<IMsgPacket> packet;
+    };
+public:
+    SessionShard(ISessionSink* sink_, QObject* parent = NULL) : QObject(parent), sink(sink_), drain_scheduled(false), session_count(0),
+                                                                dropped_count(0), wheel(DEFAULT_TIMER_TICK, this) {}
+    virtual ~SessionShard() {
+        reset();
+    }
+
+    void reset() {
+        qDeleteAll(sessions);
+        sessions.clear();
+        session_count = 0;
+    }
+    void post_open(const quint64 session_id, const QSharedPointer<ISessionStates>& states) {
+        Event event;
+        event.kind = Event::Open;
+        event.session_id = session_id;
+        event.states = states;
+        post(event);
+    }
+    void post_packet(const quint64 session_id, const QSharedPointer<IMsgPacket>& packet) {
+        Event event;
+        event.kind = Event::Packet;
+        event.session_id = session_id;
+        event.packet = packet;
+        post(event);
+    }
+    void post_close(const quint64 session_id) {
+        Event event;
+        event.kind = Event::Close;
+        event.session_id = session_id;
+        post(event);
+    }
+    int get_session_count() const {
+        return session_count.load();
+    }
+    /*Packets addressed to unknown sessions*/
+    int get_dropped_count() const {
+        return dropped_count.load();
+    }
+    void session_timed_out(const quint64 session_id) {
+        sink->on_session_timeout(session_id);
+    }
+public slots:
+    void onDrain() {
+        {
+            QMutexLocker locker(&inbox_lock);
+            events.swap(inbox);
+            drain_scheduled = false;
+        }
+        for(int i = 0; i < events.size(); ++i) {
+            process(events[i]);
+        }
+        /*Keeps capacity, buffers swap back and forth*/
+        events.resize(0);
+        flush();
+    }
+private:
+    void post(const Event& event) {
+        QMutexLocker locker(&inbox_lock);
+        inbox.append(event);
+        if(drain_scheduled) return;
+        drain_scheduled = true;
+        locker.unlock();
+        QMetaObject::invokeMethod(this, "onDrain", Qt::QueuedConnection);
+    }
+    void process(Event& event) {
+        switch(event.kind) {
+        case Event::Open: {
+            if(sessions.contains(event.session_id) || event.states.isNull()) return;
+            ManagedSession* session = new ManagedSession(event.session_id, this);
+            session->set_state_holder(event.states);
+            session->set_timer_wheel(&wheel);
+            sessions.insert(event.session_id, session);
+            ++session_count;
+            break;
+        }
+        case Event::Packet: {
+            ManagedSession* session = sessions.value(event.session_id, NULL);
+            if(session == NULL) {
+                ++dropped_count;
+                return;
+            }
+            QByteArray send_msg;
+            long timeout = 0;
+            if(!session->set_new_msg(event.packet, send_msg, timeout)) {
+                drop(event.session_id);
+                sink->on_session_failed(event.session_id);
+                return;
+            }
+            if(send_msg.isEmpty()) return;
+            outputs.append(SessionOutput(event.session_id, send_msg));
+            if(outputs.size() >= MAX_SESSION_OUTPUT_BATCH) flush();
+            break;
+        }
+        case Event::Close:
+            drop(event.session_id);
+            break;
+        default:
+            break;
+        }
+    }
+    void drop(const quint64 session_id) {
+        ManagedSession* session = sessions.take(session_id);
+        if(session == NULL) return;
+        delete session;
+        --session_count;
+    }
+    void flush() {
+        if(outputs.isEmpty()) return;
+        sink->on_send_batch(outputs);
+        outputs.resize(0);
+    }
+
+    ISessionSink* sink;
+    QMutex inbox_lock;
+    QVector<Event> inbox;
+    bool drain_scheduled;
+    QVector<Event> events;
+    QVector<SessionOutput> outputs;
+    QHash<quint64, ManagedSession*> sessions;
+    QAtomicInt session_count;
+    QAtomicInt dropped_count;
+    TimerWheel wheel;
+};
+
+inline void ManagedSession::on_session_timeout() {
+    shard->session_timed_out(session_id);
+}
+
+/*Runs session state machines on fixed set of threads, session is bound to thread by its id so all
+ * its packets are handled in order without locking. start and stop belong to owner thread,
+ * open_session, feed and close_session may be called from any thread while executor runs*/
+class SessionExecutor : public QObject {
+    Q_OBJECT
+public:
+    SessionExecutor(QObject* parent = NULL) : QObject(parent) {}
+    virtual ~SessionExecutor() {
+        stop();
+    }
+
+    bool start(ISessionSink* sink, const int thread_count = QThread::idealThreadCount()) {
+        stop();
+        if(sink == NULL || thread_count <= 0) return false;
+        for(int i = 0; i < thread_count; ++i) {
+            QThread* thread = new QThread(this);
+            SessionShard* shard = new SessionShard(sink);
+            shard->moveToThread(thread);
+            connect(thread, SIGNAL(finished()), shard, SLOT(deleteLater()));
+            thread->start();
+            shard_threads.append(thread);
+            shards.append(shard);
+        }
+        return true;
+    }
+    void stop() {
+        foreach(QThread* thread, shard_threads) {
+            thread->quit();
+            thread->wait();
+            delete thread;
+        }
+        shard_threads.clear();
+        shards.clear();
+    }
+    bool open_session(const quint64 session_id, const QSharedPointer<ISessionStates>& states) {
+        if(shards.isEmpty()) return false;
+        shard_of(session_id)->post_open(session_id, states);
+        return true;
+    }
+    bool feed(const quint64 session_id, const QSharedPointer<IMsgPacket>& packet) {
+        if(shards.isEmpty()) return false;
+        shard_of(session_id)->post_packet(session_id, packet);
+        return true;
+    }
+    bool close_session(const quint64 session_id) {
+        if(shards.isEmpty()) return false;
+        shard_of(session_id)->post_close(session_id);
+        return true;
+    }
+    int get_thread_count() const {
+        return shards.size();
+    }
+    int get_session_count() const {
+        int count = 0;
+        foreach(SessionShard* shard, shards) {
+            count += shard->get_session_count();
+        }
+        return count;
+    }
+    int get_dropped_count() const {
+        int count = 0;
+        foreach(SessionShard* shard, shards) {
+            count += shard->get_dropped_count();
+        }
+        return count;
+    }
+private:
+    SessionShard* shard_of(const quint64 session_id) const {
+        return shards.at(int(session_id % quint64(shards.size())));
+    }
+
+    QList<QThread*> shard_threads;
+    QList<SessionShard*> shards;
+};
+
+#endif // SESSIONEXECUTOR_H
@@ -0,0 +1,186 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef SHMRING_H
+#define SHMRING_H
+#pragma once
+#include <QtCore>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+
+#include <atomic>
+#include <limits>
+
+#define DEFAULT_SHM_RING_SIZE 16777216
+#define SHM_RING_HEADER_SIZE 192
+#define SHM_RECORD_HEADER_SIZE 4
+
+/*Single producer single consumer byte ring in POSIX shared memory for bulk payloads between processes of one host.
+ * Records are [u32 length][bytes] wrapped around ring end, producer publishes them by moving head with release store.
+ * Head, tail and capacity live on separate cache lines of mapped header. Creator unlinks shared memory object.
+ * Peer process is not trusted: capacity is validated and copied on attach, record lengths are checked
+ * against published bytes before anything is copied*/
+class ShmRing {
+    struct RingHeader {
+        std::atomic<quint64> head;
+        char head_pad[64 - sizeof(std::atomic<quint64>)];
+        std::atomic<quint64> tail;
+        char tail_pad[64 - sizeof(std::atomic<quint64>)];
+        quint64 capacity;
+    };
+public:
+    ShmRing() : owner(false), map_size(0), capacity(0), header(NULL), ring(NULL) {}
+    virtual ~ShmRing() {
+        reset();
+    }
+
+    void reset() {
+        if(header != NULL) ::munmap(header, map_size);
+        if(owner && !name.isEmpty()) ::shm_unlink(name.constData());
+        header = NULL;
+        ring = NULL;
+        map_size = 0;
+        capacity = 0;
+        owner = false;
+        name.clear();
+    }
+    /*Capacity is rounded up to power of two*/
+    bool create(const QByteArray& name_, const quint64 ring_capacity = DEFAULT_SHM_RING_SIZE) {
+        reset();
+        quint64 ring_size = 1;
+        while(ring_size < ring_capacity) ring_size <<= 1;
+        int descriptor = ::shm_open(name_.constData(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if(descriptor < 0) return false;
+        owner = true;
+        name = name_;
+        if(::ftruncate(descriptor, SHM_RING_HEADER_SIZE + ring_size) != 0 || !map(descriptor, SHM_RING_HEADER_SIZE + ring_size)) {
+            ::close(descriptor);
+            reset();
+            return false;
+        }
+        ::close(descriptor);
+        new (&header->head) std::atomic<quint64>(0);
+        new (&header->tail) std::atomic<quint64>(0);
+        header->capacity = ring_size;
+        capacity = ring_size;
+        return true;
+    }
+    bool attach(const QByteArray& name_) {
+        reset();
+        int descriptor = ::shm_open(name_.constData(), O_RDWR, 0600);
+        if(descriptor < 0) return false;
+        struct stat info;
+        if(::fstat(descriptor, &info) != 0 || info.st_size <= SHM_RING_HEADER_SIZE || !map(descriptor, info.st_size)) {
+            ::close(descriptor);
+            return false;
+        }
+        ::close(descriptor);
+        name = name_;
+        quint64 ring_size = header->capacity;
+        if(ring_size == 0 || (ring_size & (ring_size - 1)) != 0 || ring_size + SHM_RING_HEADER_SIZE != quint64(info.st_size)) {
+            reset();
+            return false;
+        }
+        capacity = ring_size;
+        return true;
+    }
+    bool is_valid() const {
+        return header != NULL;
+    }
+    QByteArray get_name() const {
+        return name;
+    }
+    quint64 get_capacity() const {
+        return capacity;
+    }
+    quint64 get_used() const {
+        if(header == NULL) return 0;
+        return header->head.load(std::memory_order_acquire) - header->tail.load(std::memory_order_acquire);
+    }
+    /*Producer side, returns false when record does not fit into free space*/
+    bool push(const char* data, const quint32 size) {
+        if(header == NULL) return false;
+        quint64 head = header->head.load(std::memory_order_relaxed);
+        quint64 tail = header->tail.load(std::memory_order_acquire);
+        quint64 record_size = SHM_RECORD_HEADER_SIZE + quint64(size);
+        if(head - tail > capacity || record_size > capacity - (head - tail)) return false;
+        uchar length[SHM_RECORD_HEADER_SIZE];
+        qToBigEndian<quint32>(size, length);
+        copy_in(head, reinterpret_cast<const char*>(length), SHM_RECORD_HEADER_SIZE);
+        copy_in(head + SHM_RECORD_HEADER_SIZE, data, size);
+        header->head.store(head + record_size, std::memory_order_release);
+        return true;
+    }
+    bool push(const QByteArray& data) {
+        return push(data.constData(), quint32(data.size()));
+    }
+    /*Consumer side, returns false when ring is empty or its content is inconsistent*/
+    bool pop(QByteArray& data) {
+        if(header == NULL) return false;
+        quint64 tail = header->tail.load(std::memory_order_relaxed);
+        quint64 head = header->head.load(std::memory_order_acquire);
+        if(head == tail) return false;
+        quint64 published = head - tail;
+        if(published > capacity || published < SHM_RECORD_HEADER_SIZE) return false;
+        uchar length[SHM_RECORD_HEADER_SIZE];
+        copy_out(tail, reinterpret_cast<char*>(length), SHM_RECORD_HEADER_SIZE);
+        quint32 size = qFromBigEndian<quint32>(length);
+        if(SHM_RECORD_HEADER_SIZE + quint64(size) > published || size > quint32(std::numeric_limits<int>::max())) return false;
+        data.resize(size);
+        copy_out(tail + SHM_RECORD_HEADER_SIZE, data.data(), size);
+        header->tail.store(tail + SHM_RECORD_HEADER_SIZE + size, std::memory_order_release);
+        return true;
+    }
+private:
+    bool map(const int descriptor, const quint64 size) {
+        void* address = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+        if(address == MAP_FAILED) return false;
+        map_size = size;
+        header = static_cast<RingHeader*>(address);
+        ring = static_cast<char*>(address) + SHM_RING_HEADER_SIZE;
+        return true;
+    }
+    void copy_in(const quint64 position, const char* data, const quint64 size) {
+        quint64 offset = position & (capacity - 1);
+        quint64 first = qMin(size, capacity - offset);
+        memcpy(ring + offset, data, first);
+        if(first < size) memcpy(ring, data + first, size - first);
+    }
+    void copy_out(const quint64 position, char* data, const quint64 size) const {
+        quint64 offset = position & (capacity - 1);
+        quint64 first = qMin(size, capacity - offset);
+        memcpy(data, ring + offset, first);
+        if(first < size) memcpy(data + first, ring, size - first);
+    }
+
+    bool owner;
+    QByteArray name;
+    quint64 map_size;
+    quint64 capacity;
+    RingHeader* header;
+    char* ring;
+};
+
+#endif // Q_OS_UNIX
+
+#endif // SHMRING_H
@@ -0,0 +1,244 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef STREAMMUX_H
+#define STREAMMUX_H
+#pragma once
+#include <QtNetwork>
+
+#include "connection.h"
+
+#define STREAM_ID_SIZE 4
+#define DEFAULT_STREAM_CHUNK_SIZE 16384
+#define DEFAULT_STREAM_WINDOW 262144
+#define DEFAULT_MAX_IN_STREAMS 1024
+#define DEFAULT_MAX_STREAM_BUFFER 16777216
+
+/*Logical streams over one framed connection. Every message is cut into chunks carrying stream id,
+ * chunks of streams with pending data are sent in round robin order, so large transfer never delays
+ * small messages of other streams by more than one chunk. Bytes in flight are limited by window,
+ * the rest waits in stream queues until connection reports earlier chunks as written.
+ * Incoming stream exists from its first chunk till its end chunk, count of such streams and bytes
+ * buffered per stream are capped, stream over limit is failed and its chunks are discarded till its end chunk*/
+class StreamMultiplexer : public QObject {
+    Q_OBJECT
+    struct OutMsg {
+        QByteArray data;
+        int offset;
+        quint16 msg_type;
+    };
+    struct InStream {
+        InStream() : failed(false) {}
+        bool failed;
+        QByteArray buffer;
+        QSharedPointer<IBufferParser> parser_ptr;
+    };
+public:
+    typedef IBufferParser* (*ParserFactory)();
+    /*Side which established connection uses odd stream ids, accepting side uses even ones*/
+    StreamMultiplexer(TCPConnection* conn_, const bool initiator = true, QObject* parent = NULL) : QObject(parent), conn(conn_),
+        next_stream_id(initiator ? 1 : 2), chunk_size(DEFAULT_STREAM_CHUNK_SIZE), window(DEFAULT_STREAM_WINDOW), inflight_bytes(0), pumping(false), parser_factory(NULL),
+        max_in_streams(DEFAULT_MAX_IN_STREAMS), max_stream_buffer(DEFAULT_MAX_STREAM_BUFFER) {
+        conn->set_framing_mode(TCPConnection::LengthPrefixedFraming);
+        connect(conn, SIGNAL(frame_received(quint16, quint16, QByteArray)), this, SLOT(onFrameReceived(quint16, quint16, QByteArray)));
+        connect(conn, SIGNAL(msg_completed(quint64)), this, SLOT(onChunkCompleted(quint64)));
+        connect(conn, SIGNAL(write_resumed()), this, SLOT(pump()));
+    }
+    virtual ~StreamMultiplexer() {
+        reset();
+    }
+
+    virtual void reset() {
+        out_streams.clear();
+        active_streams.clear();
+        in_streams.clear();
+        refused_streams.clear();
+        inflight_chunks.clear();
+        completed_early.clear();
+        inflight_bytes = 0;
+    }
+    void set_chunk_size(const int chunk_size_) {
+        chunk_size = qMax(1, chunk_size_);
+    }
+    void set_window(const qint64 window_) {
+        window = window_;
+    }
+    void set_inbound_limits(const int max_in_streams_, const int max_stream_buffer_) {
+        max_in_streams = max_in_streams_;
+        max_stream_buffer = max_stream_buffer_;
+    }
+    int get_in_stream_count() const {
+        return in_streams.size();
+    }
+    /*When factory is set every incoming message gets its own parser instance*/
+    void set_parser_factory(ParserFactory parser_factory_) {
+        parser_factory = parser_factory_;
+    }
+    quint32 open_stream() {
+        quint32 stream_id = next_stream_id;
+        next_stream_id += 2;
+        return stream_id;
+    }
+    void close_stream(const quint32 stream_id) {
+        out_streams.remove(stream_id);
+        active_streams.removeAll(stream_id);
+        in_streams.remove(stream_id);
+        refused_streams.remove(stream_id);
+    }
+    bool send(const quint32 stream_id, const QByteArray& msg, const quint16 msg_type = 0) {
+        if(conn.isNull()) return false;
+        OutMsg out_msg;
+        out_msg.data = msg;
+        out_msg.offset = 0;
+        out_msg.msg_type = msg_type;
+        QQueue<OutMsg>& stream_queue = out_streams[stream_id];
+        if(stream_queue.isEmpty()) active_streams.enqueue(stream_id);
+        stream_queue.enqueue(out_msg);
+        pump();
+        return true;
+    }
+    /*Send message over new stream, reply is expected on the same stream id*/
+    quint32 send_request(const QByteArray& msg, const quint16 msg_type = 0) {
+        quint32 stream_id = open_stream();
+        return send(stream_id, msg, msg_type) ? stream_id : 0;
+    }
+    qint64 get_inflight_bytes() const {
+        return inflight_bytes;
+    }
+    /*Parser of incoming stream, parsed message is available while stream_msg_parsed is handled*/
+    IBufferParser* get_stream_parser(const quint32 stream_id) const {
+        return in_streams.value(stream_id).parser_ptr.data();
+    }
+signals:
+    void stream_msg_received(quint32 stream_id, quint16 msg_type, const QByteArray& msg);
+    /*Emitted when per stream parser reports complete message*/
+    void stream_msg_parsed(quint32 stream_id, quint16 msg_type);
+    /*Incoming stream exceeded inbound limits, its data is dropped*/
+    void stream_failed(quint32 stream_id);
+public slots:
+    void pump() {
+        if(pumping) return;
+        pumping = true;
+        while(!conn.isNull() && !active_streams.isEmpty() && inflight_bytes < window && !conn->is_write_paused()) {
+            quint32 stream_id = active_streams.dequeue();
+            QQueue<OutMsg>& stream_queue = out_streams[stream_id];
+            OutMsg& out_msg = stream_queue.head();
+            int size = qMin(chunk_size, out_msg.data.size() - out_msg.offset);
+            bool is_last = out_msg.offset + size == out_msg.data.size();
+            QByteArray payload(STREAM_ID_SIZE + size, Qt::Uninitialized);
+            qToBigEndian<quint32>(stream_id, reinterpret_cast<uchar*>(payload.data()));
+            memcpy(payload.data() + STREAM_ID_SIZE, out_msg.data.constData() + out_msg.offset, size);
+            quint16 flags = FrameHeader::StreamChunkFlag | (is_last ? FrameHeader::StreamEndFlag : 0);
+            quint64 msg_id = conn->post_frame(payload, out_msg.msg_type, flags);
+            /*Connection may write chunk synchronously and report it before post_frame returns,
+             * other ids reported meanwhile belong to frames not sent by multiplexer*/
+            bool is_completed = completed_early.contains(msg_id);
+            completed_early.clear();
+            if(msg_id == 0) {
+                active_streams.prepend(stream_id);
+                break;
+            }
+            if(!is_completed) {
+                inflight_chunks.insert(msg_id, payload.size());
+                inflight_bytes += payload.size();
+            }
+            out_msg.offset += size;
+            if(is_last) stream_queue.dequeue();
+            if(stream_queue.isEmpty())
+                out_streams.remove(stream_id);
+            else
+                active_streams.enqueue(stream_id);
+        }
+        pumping = false;
+    }
+private slots:
+    void onChunkCompleted(quint64 msg_id) {
+        QHash<quint64, int>::iterator iter = inflight_chunks.find(msg_id);
+        if(iter == inflight_chunks.end()) {
+            if(pumping) completed_early.insert(msg_id);
+            return;
+        }
+        inflight_bytes -= iter.value();
+        inflight_chunks.erase(iter);
+        pump();
+    }
+    void onFrameReceived(quint16 frame_type, quint16 frame_flags, const QByteArray& payload) {
+        if(!(frame_flags & FrameHeader::StreamChunkFlag) || payload.size() < STREAM_ID_SIZE) return;
+        quint32 stream_id = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(payload.constData()));
+        bool is_end = (frame_flags & FrameHeader::StreamEndFlag) != 0;
+        /*Refused stream is remembered till its end chunk, so its tail is not taken for new stream*/
+        if(refused_streams.contains(stream_id)) {
+            if(is_end) refused_streams.remove(stream_id);
+            return;
+        }
+        QHash<quint32, InStream>::iterator iter = in_streams.find(stream_id);
+        if(iter == in_streams.end()) {
+            if(in_streams.size() >= max_in_streams) {
+                if(!is_end) refused_streams.insert(stream_id);
+                emit stream_failed(stream_id);
+                return;
+            }
+            iter = in_streams.insert(stream_id, InStream());
+        }
+        InStream& in_stream = iter.value();
+        int data_size = payload.size() - STREAM_ID_SIZE;
+        if(!in_stream.failed && in_stream.buffer.size() > max_stream_buffer - data_size) {
+            in_stream.failed = true;
+            in_stream.buffer.clear();
+            emit stream_failed(stream_id);
+        }
+        if(in_stream.failed) {
+            if(is_end) in_streams.erase(iter);
+            return;
+        }
+        in_stream.buffer.append(payload.constData() + STREAM_ID_SIZE, data_size);
+        if(!is_end) return;
+        QByteArray msg;
+        msg.swap(in_stream.buffer);
+        QSharedPointer<IBufferParser> parser_ptr = in_stream.parser_ptr;
+        if(parser_factory != NULL && parser_ptr.isNull()) {
+            parser_ptr.reset(parser_factory());
+            in_stream.parser_ptr = parser_ptr;
+        }
+        emit stream_msg_received(stream_id, frame_type, msg);
+        if(!parser_ptr.isNull()) {
+            parser_ptr->parse(msg.constData(), msg.size());
+            if(parser_ptr->isValidMsg() && parser_ptr->isEndMsg()) emit stream_msg_parsed(stream_id, frame_type);
+        }
+        /*Handlers above may have closed stream, so it is looked up again*/
+        in_streams.remove(stream_id);
+    }
+private:
+    QPointer<TCPConnection> conn;
+    quint32 next_stream_id;
+    int chunk_size;
+    qint64 window;
+    qint64 inflight_bytes;
+    bool pumping;
+    ParserFactory parser_factory;
+    int max_in_streams;
+    int max_stream_buffer;
+    QHash<quint32, QQueue<OutMsg> > out_streams;
+    QQueue<quint32> active_streams;
+    QHash<quint32, InStream> in_streams;
+    QSet<quint32> refused_streams;
+    QHash<quint64, int> inflight_chunks;
+    QSet<quint64> completed_early;
+};
+
+#endif // STREAMMUX_H
@@ -0,0 +1,151 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef SUBNETTRIE_H
+#define SUBNETTRIE_H
+#pragma once
+#include <QtNetwork>
+
+#include <cstring>
+
+/*Binary prefix trie over address bits, separate roots for IPv4 and IPv6.
+ * Lookup cost depends only on address length (32 or 128 steps), not on count of stored subnets.
+ * Nodes are kept in one vector and reference children by index*/
+class SubnetTrie {
+    struct Node {
+        Node() : terminal(false) {
+            child[0] = child[1] = -1;
+        }
+        int child[2];
+        bool terminal;
+    };
+    enum Roots {
+        IPv4Root = 0,
+        IPv6Root
+    };
+public:
+    SubnetTrie() {
+        reset();
+    }
+    virtual ~SubnetTrie() {}
+
+    void reset() {
+        nodes.clear();
+        nodes.append(Node());
+        nodes.append(Node());
+        subnet_count = 0;
+    }
+    bool isEmpty() const {
+        return subnet_count == 0;
+    }
+    int size() const {
+        return subnet_count;
+    }
+    /*prefix_len < 0 means whole address*/
+    bool add(const QHostAddress& address, int prefix_len = -1) {
+        AddressBits bits;
+        if(!bits.init(address, prefix_len)) return false;
+        int index = bits.root;
+        for(int i = 0; i < bits.prefix_len; ++i) {
+            int bit = bits.bit(i);
+            if(nodes[index].child[bit] < 0) {
+                nodes[index].child[bit] = nodes.size();
+                nodes.append(Node());
+            }
+            index = nodes[index].child[bit];
+        }
+        if(nodes[index].terminal) return false;
+        nodes[index].terminal = true;
+        ++subnet_count;
+        return true;
+    }
+    /*Subnet in CIDR notation, e.g. "10.0.0.0/8" or "2001:db8::/32"*/
+    bool add(const QString& subnet) {
+        QPair<QHostAddress, int> parsed = QHostAddress::parseSubnet(subnet);
+        if(parsed.first.isNull()) return false;
+        return add(parsed.first, parsed.second);
+    }
+    /*Nodes of removed subnet are left in place and reused if subnet is added again*/
+    bool remove(const QHostAddress& address, int prefix_len = -1) {
+        AddressBits bits;
+        if(!bits.init(address, prefix_len)) return false;
+        int index = bits.root;
+        for(int i = 0; i < bits.prefix_len && index >= 0; ++i) {
+            index = nodes[index].child[bits.bit(i)];
+        }
+        if(index < 0 || !nodes[index].terminal) return false;
+        nodes[index].terminal = false;
+        --subnet_count;
+        return true;
+    }
+    bool remove(const QString& subnet) {
+        QPair<QHostAddress, int> parsed = QHostAddress::parseSubnet(subnet);
+        if(parsed.first.isNull()) return false;
+        return remove(parsed.first, parsed.second);
+    }
+    /*True if address belongs to any stored subnet*/
+    bool contains(const QHostAddress& address) const {
+        if(subnet_count == 0) return false;
+        AddressBits bits;
+        if(!bits.init(address, -1)) return false;
+        int index = bits.root;
+        for(int i = 0; index >= 0; ++i) {
+            if(nodes[index].terminal) return true;
+            if(i == bits.prefix_len) break;
+            index = nodes[index].child[bits.bit(i)];
+        }
+        return false;
+    }
+private:
+    struct AddressBits {
+        bool init(const QHostAddress& address, int prefix_len_) {
+            bool is_ipv4 = false;
+            quint32 ipv4 = address.toIPv4Address(&is_ipv4);
+            if(is_ipv4) {
+                root = IPv4Root;
+                qToBigEndian<quint32>(ipv4, bytes);
+                max_len = 32;
+            }
+            else if(address.protocol() == QAbstractSocket::IPv6Protocol) {
+                root = IPv6Root;
+                Q_IPV6ADDR ipv6 = address.toIPv6Address();
+                memcpy(bytes, ipv6.c, 16);
+                max_len = 128;
+            }
+            else {
+                return false;
+            }
+            /*Prefix given for IPv4 mapped IPv6 address counts mapped part too*/
+            if(prefix_len_ > max_len && max_len == 32) prefix_len_ -= 96;
+            prefix_len = (prefix_len_ < 0 || prefix_len_ > max_len) ? max_len : prefix_len_;
+            return true;
+        }
+        int bit(const int i) const {
+            return (bytes[i >> 3] >> (7 - (i & 7))) & 1;
+        }
+        uchar bytes[16];
+        int root;
+        int max_len;
+        int prefix_len;
+    };
+
+    QVector<Node> nodes;
+    int subnet_count;
+};
+
+#endif // SUBNETTRIE_H
@@ -0,0 +1,236 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+#pragma once
+#include <QtCore>
+
+#define DEFAULT_TIMER_TICK 10
+#define WHEEL_LEVELS 4
+#define WHEEL_ROOT_BITS 8
+#define WHEEL_LEVEL_BITS 6
+#define WHEEL_ROOT_SIZE (1 << WHEEL_ROOT_BITS)
+#define WHEEL_LEVEL_SIZE (1 << WHEEL_LEVEL_BITS)
+#define WHEEL_MAX_TICKS ((Q_UINT64_C(1) << (WHEEL_ROOT_BITS + (WHEEL_LEVELS - 1) * WHEEL_LEVEL_BITS)) - 1)
+
+class ITimerHandler {
+public:
+    virtual ~ITimerHandler() {}
+
+    virtual void on_timer_expired(const quint64 tag) = 0;
+};
+
+/*Hierarchical timing wheel: 256 slots of one tick each on first level and three levels of 64 slots,
+ * every level covers whole turn of previous one. Timers are kept in intrusive doubly linked slot lists
+ * inside one node vector, so arming and cancelling are O(1) and cost no allocation once vector has grown.
+ * Timers of higher levels are moved one level down when lower level completes its turn.
+ * Single QTimer drives the wheel and runs only while any timer is armed. Wheel belongs to one thread*/
+class TimerWheel : public QObject {
+    Q_OBJECT
+    struct TimerNode {
+        quint64 expire_tick;
+        quint64 tag;
+        ITimerHandler* handler;
+        quint32 generation;
+        int slot;
+        int prev;
+        int next;
+    };
+public:
+    typedef quint64 TimerId;
+    TimerWheel(const int tick_ms_ = DEFAULT_TIMER_TICK, QObject* parent = NULL) : QObject(parent), tick_ms(qMax(1, tick_ms_)), tick_timer(this) {
+        connect(&tick_timer, SIGNAL(timeout()), this, SLOT(onTick()));
+        reset();
+    }
+    virtual ~TimerWheel() {}
+
+    void reset() {
+        tick_timer.stop();
+        nodes.clear();
+        free_nodes.clear();
+        for(int i = 0; i < WHEEL_ROOT_SIZE + (WHEEL_LEVELS - 1) * WHEEL_LEVEL_SIZE; ++i) {
+            slot_heads[i] = -1;
+        }
+        current_tick = 0;
+        active_count = 0;
+        clock.start();
+    }
+    int get_tick() const {
+        return tick_ms;
+    }
+    int size() const {
+        return active_count;
+    }
+    /*Call handler->on_timer_expired(tag) not earlier than timeout_ms later, returns id for cancel*/
+    TimerId arm(const qint64 timeout_ms, ITimerHandler* handler, const quint64 tag = 0) {
+        if(active_count == 0) start_ticking();
+        int index = alloc_node();
+        TimerNode& node = nodes[index];
+        node.handler = handler;
+        node.tag = tag;
+        node.expire_tick = expire_for(timeout_ms);
+        link_node(index);
+        ++active_count;
+        return (TimerId(node.generation) << 32) | quint32(index);
+    }
+    bool cancel(const TimerId timer_id) {
+        int index = int(timer_id & 0xFFFFFFFF);
+        if(!is_armed(timer_id)) return false;
+        unlink_node(index);
+        free_node(index);
+        if(--active_count == 0) tick_timer.stop();
+        return true;
+    }
+    /*Move armed timer to new deadline keeping its id*/
+    bool rearm(const TimerId timer_id, const qint64 timeout_ms) {
+        int index = int(timer_id & 0xFFFFFFFF);
+        if(!is_armed(timer_id)) return false;
+        unlink_node(index);
+        nodes[index].expire_tick = expire_for(timeout_ms);
+        link_node(index);
+        return true;
+    }
+    bool is_armed(const TimerId timer_id) const {
+        int index = int(timer_id & 0xFFFFFFFF);
+        if(timer_id == 0 || index >= nodes.size()) return false;
+        const TimerNode& node = nodes.at(index);
+        return node.slot >= 0 && node.generation == quint32(timer_id >> 32);
+    }
+    /*Process every tick up to current time, returns count of expired timers*/
+    int advance() {
+        quint64 target_tick = quint64(clock.elapsed()) / tick_ms;
+        int expired = 0;
+        while(current_tick <= target_tick && active_count > 0) {
+            expired += process_tick();
+        }
+        if(active_count == 0) current_tick = target_tick + 1;
+        return expired;
+    }
+private slots:
+    void onTick() {
+        advance();
+    }
+private:
+    /*Deadline counts from wall clock, wheel may lag behind it when event loop was busy*/
+    quint64 expire_for(const qint64 timeout_ms) const {
+        quint64 ticks = timeout_ms <= 0 ? 1 : quint64((timeout_ms + tick_ms - 1) / tick_ms);
+        ticks = qBound(Q_UINT64_C(1), ticks, quint64(WHEEL_MAX_TICKS));
+        quint64 clock_tick = quint64(clock.elapsed()) / tick_ms;
+        return qMax(current_tick, clock_tick + 1) + ticks - 1;
+    }
+    void start_ticking() {
+        quint64 clock_tick = quint64(clock.elapsed()) / tick_ms;
+        if(current_tick < clock_tick) current_tick = clock_tick;
+        tick_timer.start(tick_ms);
+    }
+    int process_tick() {
+        int index = int(current_tick & (WHEEL_ROOT_SIZE - 1));
+        if(index == 0) {
+            int level = 1;
+            while(level < WHEEL_LEVELS && cascade(level) == 0) ++level;
+        }
+        int expired = 0;
+        while(slot_heads[index] >= 0) {
+            int node_index = slot_heads[index];
+            ITimerHandler* handler = nodes[node_index].handler;
+            quint64 tag = nodes[node_index].tag;
+            unlink_node(node_index);
+            free_node(node_index);
+            --active_count;
+            ++expired;
+            handler->on_timer_expired(tag);
+        }
+        ++current_tick;
+        if(active_count == 0) tick_timer.stop();
+        return expired;
+    }
+    /*Move timers of current slot of level one level down, returns index of processed slot*/
+    int cascade(const int level) {
+        int shift = WHEEL_ROOT_BITS + (level - 1) * WHEEL_LEVEL_BITS;
+        int index = int((current_tick >> shift) & (WHEEL_LEVEL_SIZE - 1));
+        int slot = WHEEL_ROOT_SIZE + (level - 1) * WHEEL_LEVEL_SIZE + index;
+        int node_index = slot_heads[slot];
+        slot_heads[slot] = -1;
+        while(node_index >= 0) {
+            int next = nodes[node_index].next;
+            link_node(node_index);
+            node_index = next;
+        }
+        return index;
+    }
+    void link_node(const int index) {
+        TimerNode& node = nodes[index];
+        quint64 expire = node.expire_tick;
+        quint64 delta = expire - current_tick;
+        int slot = 0;
+        if(expire < current_tick) {
+            slot = int(current_tick & (WHEEL_ROOT_SIZE - 1));
+        }
+        else if(delta < WHEEL_ROOT_SIZE) {
+            slot = int(expire & (WHEEL_ROOT_SIZE - 1));
+        }
+        else {
+            int level = 1;
+            int shift = WHEEL_ROOT_BITS;
+            while(level < WHEEL_LEVELS - 1 && delta >= (Q_UINT64_C(1) << (shift + WHEEL_LEVEL_BITS))) {
+                ++level;
+                shift += WHEEL_LEVEL_BITS;
+            }
+            slot = WHEEL_ROOT_SIZE + (level - 1) * WHEEL_LEVEL_SIZE + int((expire >> shift) & (WHEEL_LEVEL_SIZE - 1));
+        }
+        node.slot = slot;
+        node.prev = -1;
+        node.next = slot_heads[slot];
+        if(node.next >= 0) nodes[node.next].prev = index;
+        slot_heads[slot] = index;
+    }
+    void unlink_node(const int index) {
+        TimerNode& node = nodes[index];
+        if(node.prev >= 0)
+            nodes[node.prev].next = node.next;
+        else
+            slot_heads[node.slot] = node.next;
+        if(node.next >= 0) nodes[node.next].prev = node.prev;
+        node.slot = node.prev = node.next = -1;
+    }
+    int alloc_node() {
+        if(!free_nodes.isEmpty()) return free_nodes.pop();
+        TimerNode node;
+        node.generation = 1;
+        node.slot = node.prev = node.next = -1;
+        nodes.append(node);
+        return nodes.size() - 1;
+    }
+    void free_node(const int index) {
+        ++nodes[index].generation;
+        nodes[index].handler = NULL;
+        free_nodes.push(index);
+    }
+
+    int tick_ms;
+    int active_count;
+    quint64 current_tick;
+    QElapsedTimer clock;
+    QTimer tick_timer;
+    int slot_heads[WHEEL_ROOT_SIZE + (WHEEL_LEVELS - 1) * WHEEL_LEVEL_SIZE];
+    QVector<TimerNode> nodes;
+    QStack<int> free_nodes;
+};
+
+#endif // TIMERWHEEL_H
@@ -0,0 +1,105 @@
+/**The MIT License (MIT)
+Copyright (c) 2018 by AleksanderSergeevich
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef TLSSESSIONCACHE_H
+#define TLSSESSIONCACHE_H
+#pragma once
+#include <QtNetwork>
+
+#include <atomic>
+
+#define DEFAULT_TLS_SESSION_CACHE_SIZE 1024
+#define DEFAULT_TLS_SESSION_LIFETIME 7200
+
+/*Client side cache of TLS session tickets keyed by peer, least recently used peers are evicted first.
+ * Shared between connections, so access is serialized*/
+class TlsSessionCache {
+    struct SessionDesc {
+        QByteArray ticket;
+        QDateTime expiry_time;
+    };
+public:
+    TlsSessionCache(const int capacity = DEFAULT_TLS_SESSION_CACHE_SIZE) : resumed_count(0), full_count(0) {
+        sessions.setMaxCost(capacity);
+    }
+    virtual ~TlsSessionCache() {
+        reset();
+    }
+
+    void reset() {
+        QMutexLocker locker(&lock);
+        sessions.clear();
+    }
+    static QString peer_key(const QString& host_address, const quint16 port) {
+        return QString("%1:%2").arg(host_address).arg(port);
+    }
+    bool get_session(const QString& peer_key, QByteArray& ticket) {
+        QMutexLocker locker(&lock);
+        SessionDesc* desc = sessions.object(peer_key);
+        if(desc == NULL) return false;
+        if(desc->expiry_time < QDateTime::currentDateTimeUtc()) {
+            sessions.remove(peer_key);
+            return false;
+        }
+        ticket = desc->ticket;
+        return true;
+    }
+    /*lifetime_hint is taken from QSslConfiguration::sessionTicketLifeTimeHint, in seconds*/
+    void store_session(const QString& peer_key, const QByteArray& ticket, const int lifetime_hint = DEFAULT_TLS_SESSION_LIFETIME) {
+        if(ticket.isEmpty()) return;
+        SessionDesc* desc = new SessionDesc();
+        desc->ticket = ticket;
+        desc->expiry_time = QDateTime::currentDateTimeUtc().addSecs(lifetime_hint > 0 ? lifetime_hint : DEFAULT_TLS_SESSION_LIFETIME);
+        QMutexLocker locker(&lock);
+        sessions.insert(peer_key, desc);
+    }
+    void remove_session(const QString& peer_key) {
+        QMutexLocker locker(&lock);
+        sessions.remove(peer_key);
+    }
+    void register_handshake(const bool resumed) {
+        if(resumed)
+            ++resumed_count;
+        else
+            ++full_count;
+    }
+    quint64 get_resumed_count() const {
+        return resumed_count.load();
+    }
+    quint64 get_full_count() const {
+        return full_count.load();
+    }
+    /*Client has to keep session data to be able to offer it on reconnect*/
+    static void configure_client(QSslConfiguration& config) {
+        config.setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+        config.setSslOption(QSsl::SslOptionDisableSessionSharing, false);
+        config.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    }
+    /*Server issues session tickets, so returning clients skip certificate exchange and key agreement*/
+    static void configure_server(QSslConfiguration& config) {
+        config.setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+        config.setSslOption(QSsl::SslOptionDisableSessionSharing, false);
+    }
+private:
+    std::atomic<quint64> resumed_count;
+    std::atomic<quint64> full_count;
+    QMutex lock;
+    QCache<QString, SessionDesc> sessions;
+};
+
+#endif // TLSSESSIONCACHE_H